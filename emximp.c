@@ -28,10 +28,28 @@ Boston, MA 02111-1307, USA.  */
 #include <process.h>
 #include <ar.h>
 #include <time.h>
+#include <setjmp.h>
 #include <sys/moddef.h>
 #include "defs.h"
 #include <sys/omflib.h>
 
+#if defined (__unix__) || defined (__APPLE__)
+#include <unistd.h>
+#endif
+
+#if defined (_POSIX_MAPPED_FILES) && _POSIX_MAPPED_FILES > 0
+#define USE_MMAP
+#include <sys/mman.h>
+#endif
+
+#if defined (_POSIX_THREADS) && _POSIX_THREADS > 0
+#define USE_THREADS
+#include <pthread.h>
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
 #define VERSION "0.9d"
 
 #define NORETURN2 __attribute__ ((noreturn))
@@ -45,22 +63,91 @@ Boston, MA 02111-1307, USA.  */
 #define N_IMP1 0x68
 #define N_IMP2 0x6a
 
+#define AR_ARENA_SIZE 0x40000
+#define AR_SYMDEF     "__.SYMDEF"
+
+#define NAME_HASH_SIZE 509
+
+#define DEF_CACHE_MAGIC   "emximp\x1a"
+#define DEF_CACHE_FORMAT  1
+#define DEF_CACHE_LIBRARY 0x80000000 /* Record is a LIBRARY statement */
+#define DEF_CACHE_NONE    0xffffffff /* No internal name */
+
+#define RS_INIT_SIZE  1024         /* Initial size of the resolver table */
+
 #define PARMS_REG     (-1)
 #define PARMS_FAR16   (-2)
 
 struct lib
 {
   struct lib *next;
+  struct lib *hash_next;        /* Next entry in the same bucket */
   char *name;
   int lbl;
+  dword addr;                   /* Address of the name in the object */
 };
 
 struct predef
 {
   struct predef *next;
+  struct predef *hash_next;     /* Next entry in the same bucket */
+  char *name;
+  int sym;                      /* Symbol number in the object or -1 */
+};
+
+/* An import collected by a worker for the import library modes.  The
+   modules are written to the library by the main thread. */
+
+struct import
+{
+  struct import *next;
+  char *func;
+  char *module;
+  long ord;
   char *name;
 };
 
+/* A job converts one input file.  If input files are converted in
+   parallel, each job writes its output to a private temporary file
+   which is copied to the output file in the order of the command
+   line.  Diagnostics are held back the same way, so that they appear
+   as if the input files had been converted one after the other. */
+
+struct job
+{
+  const char *fname;            /* Input file */
+  int index;                    /* Position on the command line */
+  FILE *out;                    /* Private output file or NULL */
+  char *arena;                  /* Private a.out archive members or NULL */
+  long arena_len;
+  struct ar_sym *syms;          /* Symbols defined by the members */
+  long sym_count;
+  char *sym_str;
+  long *members;                /* Offsets of a.out archive members */
+  long member_count;
+  long member_alloc;
+  struct import *imports;       /* Imports for M_IMP_TO_LIB, M_DEF_TO_LIB */
+  struct import **imports_add;
+  FILE *diag;                   /* Held back diagnostics or NULL */
+  jmp_buf fail;                 /* Fatal errors jump here */
+  int failed;
+  int warnings;
+  int done;
+};
+
+/* An entry of the resolver table, which maps symbol names to imports.
+   The strings are stored in rs_str. */
+
+struct rs_entry
+{
+  long name;                    /* Symbol name, -1 if the slot is empty */
+  long module;                  /* Name of the DLL */
+  long proc;                    /* Entry point name, -1 for ordinal */
+  int ordinal;
+  dword hash;
+  const char *fname;            /* Input file defining the symbol */
+};
+
 enum modes
 {
   M_NONE,                       /* No mode selected */
@@ -72,29 +159,56 @@ enum modes
   M_IMP_TO_LIB,                 /* .imp -> .lib */
   M_DEF_TO_IMP,                 /* .def -> .imp */
   M_DEF_TO_A,                   /* .def -> .a */
-  M_DEF_TO_LIB                  /* .def -> .lib */
+  M_DEF_TO_LIB,                 /* .def -> .lib */
+  M_RESOLVE                     /* Look up symbols in the input files */
 };
 
-static FILE *out_file = NULL;
-static char out_fname[128];
-static struct lib *libs;
+static THREAD_LOCAL FILE *out_file = NULL;
+static char out_fname[512];
+static char *idx_fname;
+static THREAD_LOCAL struct lib *libs;
 static struct predef *predefs;
+
+/* Hash tables for looking up modules in LIBS and PREDEFS, ignoring
+   letter case like stricmp(). */
+
+static THREAD_LOCAL struct lib *lib_hash[NAME_HASH_SIZE];
+static struct predef *predef_hash[NAME_HASH_SIZE];
 static char *out_base;
 static int base_len;
 static char *as_name;
 static int pipe_flag;
+static int obj_flag;
 static int profile_flag;
 static int opt_b;
+static int opt_c;
 static int opt_q;
 static int opt_s;
+static int opt_x;
+static int dict_stats_flag;
 static enum modes mode = M_NONE;
-static long mod_lbl;
-static long seq_no = 1;
+static THREAD_LOCAL long mod_lbl;
+static THREAD_LOCAL long seq_no = 1;
 static char *first_module = NULL;
-static int warnings = 0;
+static THREAD_LOCAL int warnings = 0;
 static struct omflib *out_lib;
+static struct import *lib_imports = NULL;
+static struct import **lib_imports_add = &lib_imports;
 static char lib_errmsg[512];
-static char *module_name = NULL;
+static THREAD_LOCAL char *module_name = NULL;
+static int jobs = 1;
+static char *cache_dir = NULL;
+static THREAD_LOCAL struct job *cur_job = NULL;
+static char **queries = NULL;
+static int query_count = 0;
+static struct rs_entry *rs_tab = NULL;
+static long rs_size = 0;
+static long rs_count = 0;
+static char *rs_str = NULL;
+static long rs_str_len = 0;
+static long rs_str_size = 0;
+static long rs_last_module = -1;
+static const char *rs_fname;
 
 
 static void error (const char *fmt, ...) NORETURN2;
@@ -102,6 +216,13 @@ static void write_error (const char *fname) NORETURN2;
 static void lib_error (void) NORETURN2;
 static void write_a_import (const char *func_name, const char *mod_name,
     int ordinal, const char *proc_name);
+static void obj_start (void);
+static void obj_stub (const char *func, const char *module, long ord,
+    const char *name, long parms, int mod_type, const char *mod_ref,
+    struct predef *pp1, struct lib *lp1);
+static void obj_finish (void);
+static void resolve_add (const char *func, const char *module, int ordinal,
+    const char *proc);
 
 
 static void usage (void)
@@ -111,30 +232,63 @@ static void usage (void)
   puts ("  emximp [-a[<assembler>]] [-b <base_name>|<prefix_length>] "
         "[-p <module>] ...");
   puts ("         [-s] <input_file>.imp");
-  puts ("  emximp [-m] -o <output_file>.a <input_file>.def ...");
+  puts ("  emximp [-k <dir>] [-m] -o <output_file>.a <input_file>.def ...");
   puts ("  emximp [-m] -o <output_file>.a <input_file>.imp ...");
-  puts ("  emximp [-m] -o <output_file>.a <input_file>.lib ...");
+  puts ("  emximp [-c] [-m] -o <output_file>.a <input_file>.lib ...");
   puts ("  emximp -o <output_file>.def <input_file>.imp ...");
-  puts ("  emximp -o <output_file>.imp <input_file>.def ...");
-  puts ("  emximp -o <output_file>.imp <input_file>.lib ...");
-  puts ("  emximp [-p#] -o <output_file>.lib <input_file>.def ...");
-  puts ("  emximp [-p#] -o <output_file>.lib <input_file>.imp...");
+  puts ("  emximp [-k <dir>] -o <output_file>.imp <input_file>.def ...");
+  puts ("  emximp [-c] -o <output_file>.imp <input_file>.lib ...");
+  puts ("  emximp [-k <dir>] [-p#] [-x] -o <output_file>.lib "
+        "<input_file>.def ...");
+  puts ("  emximp [-p#] [-x] -o <output_file>.lib <input_file>.imp...");
+  puts ("  emximp [-c] [-k <dir>] -r <symbol>|- ... <input_file> ...");
   puts ("Options:");
-  puts ("  -p#  Set page size");
+  puts ("  -a   Create .o files, using <assembler> if given");
+  puts ("  -c   Verify the record checksums of .lib files");
+  puts ("  -j#  Use up to # threads");
+  puts ("  -k   Cache parsed .def files in directory <dir>");
+  puts ("  -p#  Set page size, -p auto chooses the smallest page size "
+        "possible");
   puts ("  -q   Be quiet");
+  puts ("  -r   Find the input file defining <symbol>, - reads names "
+        "from stdin");
   puts ("  -m   Call _mcount for profiling");
+  puts ("  -x   Write symbol index <output_file>.ndx next to "
+        "<output_file>.lib");
+  puts ("  --dict-stats  Show statistics about the dictionary of the "
+        ".lib file");
   exit (1);
 }
 
 
+/* Return the stream for diagnostics.  In a worker, diagnostics go to
+   a temporary file of the current job, see splice_job(). */
+
+static FILE *diag_file (void)
+{
+  if (cur_job == NULL)
+    return stderr;
+  if (cur_job->diag == NULL)
+    cur_job->diag = tmpfile ();
+  return (cur_job->diag != NULL ? cur_job->diag : stderr);
+}
+
+
+/* Print a message.  In a worker, end the current job instead of
+   terminating the program. */
+
 static void error (const char *fmt, ...)
 {
   va_list arg_ptr;
+  FILE *f;
 
   va_start (arg_ptr, fmt);
-  fprintf (stderr, "emximp: ");
-  vfprintf (stderr, fmt, arg_ptr);
-  fputc ('\n', stderr);
+  f = diag_file ();
+  fprintf (f, "emximp: ");
+  vfprintf (f, fmt, arg_ptr);
+  fputc ('\n', f);
+  if (cur_job != NULL)
+    longjmp (cur_job->fail, 1);
   exit (2);
 }
 
@@ -142,11 +296,13 @@ static void error (const char *fmt, ...)
 static void warning (const char *fmt, ...)
 {
   va_list arg_ptr;
+  FILE *f;
 
   va_start (arg_ptr, fmt);
-  fprintf (stderr, "emximp: ");
-  vfprintf (stderr, fmt, arg_ptr);
-  fputc ('\n', stderr);
+  f = diag_file ();
+  fprintf (f, "emximp: ");
+  vfprintf (f, fmt, arg_ptr);
+  fputc ('\n', f);
   ++warnings;
 }
 
@@ -156,11 +312,13 @@ static void warning (const char *fmt, ...)
 static void information (const char *fmt, ...)
 {
   va_list arg_ptr;
+  FILE *f;
 
   va_start (arg_ptr, fmt);
-  fprintf (stderr, "emximp: ");
-  vfprintf (stderr, fmt, arg_ptr);
-  fputc ('\n', stderr);
+  f = diag_file ();
+  fprintf (f, "emximp: ");
+  vfprintf (f, fmt, arg_ptr);
+  fputc ('\n', f);
 }
 
 
@@ -216,6 +374,8 @@ static void out_flush (void)
   
   if (out_file != NULL)
     {
+      if (obj_flag)
+        obj_finish ();
       if (fflush (out_file) != 0)
         write_error (out_fname);
       if (pipe_flag)
@@ -253,11 +413,108 @@ static void out_flush (void)
 }
 
 
-static void out_start (void)
+/* Compute the hash code of NAME, ignoring letter case. */
+
+static unsigned name_hash (const char *name)
+{
+  unsigned h;
+
+  h = 0;
+  while (*name != 0)
+    h = h * 33 + tolower ((unsigned char)*name++);
+  return h % NAME_HASH_SIZE;
+}
+
+
+static struct lib *find_lib (const char *name)
+{
+  struct lib *lp1;
+
+  for (lp1 = lib_hash[name_hash (name)]; lp1 != NULL; lp1 = lp1->hash_next)
+    if (stricmp (name, lp1->name) == 0)
+      break;
+  return lp1;
+}
+
+
+static struct lib *add_lib (const char *name)
+{
+  struct lib *lp1;
+  unsigned h;
+
+  h = name_hash (name);
+  lp1 = xmalloc (sizeof (struct lib));
+  lp1->name = xstrdup (name);
+  lp1->lbl = mod_lbl++;
+  lp1->next = libs;
+  libs = lp1;
+  lp1->hash_next = lib_hash[h];
+  lib_hash[h] = lp1;
+  return lp1;
+}
+
+
+static void free_libs (void)
 {
   struct lib *lp1, *lp2;
+
+  for (lp1 = libs; lp1 != NULL; lp1 = lp2)
+    {
+      lp2 = lp1->next;
+      lib_hash[name_hash (lp1->name)] = NULL;
+      free (lp1->name);
+      free (lp1);
+    }
+  libs = NULL; mod_lbl = 1;
+}
+
+
+static struct predef *find_predef (const char *name)
+{
+  struct predef *pp1;
+
+  for (pp1 = predef_hash[name_hash (name)]; pp1 != NULL;
+       pp1 = pp1->hash_next)
+    if (stricmp (name, pp1->name) == 0)
+      break;
+  return pp1;
+}
+
+
+/* Enter the modules of PREDEFS into predef_hash.  If a module has
+   been given more than once, the last -p option wins. */
+
+static void hash_predefs (void)
+{
+  struct predef *pp1;
+  unsigned h;
+
+  for (pp1 = predefs; pp1 != NULL; pp1 = pp1->next)
+    if (find_predef (pp1->name) == NULL)
+      {
+        h = name_hash (pp1->name);
+        pp1->hash_next = predef_hash[h];
+        predef_hash[h] = pp1;
+      }
+}
+
+
+static void out_start (void)
+{
   char name[512], cmd[512];
   
+  if (obj_flag)
+    {
+      _splitpath (out_fname, NULL, NULL, name, NULL);
+      strcat (name, ".o");
+      _strncpy (out_fname, name, sizeof (out_fname));
+      out_file = fopen (out_fname, "wb");
+      if (out_file == NULL)
+        error ("Cannot open output file `%s'", out_fname);
+      obj_start ();
+      free_libs ();
+      return;
+    }
   if (pipe_flag)
     {
       _splitpath (out_fname, NULL, NULL, name, NULL);
@@ -275,13 +532,7 @@ static void out_start (void)
     }
   fprintf (out_file, "/ %s (emx+gcc)\n\n", out_fname);
   fprintf (out_file, "\t.text\n");
-  for (lp1 = libs; lp1 != NULL; lp1 = lp2)
-    {
-      lp2 = lp1->next;
-      free (lp1->name);
-      free (lp1);
-    }
-  libs = NULL; mod_lbl = 1;
+  free_libs ();
 }
 
 
@@ -291,7 +542,31 @@ static void write_lib_import (const char *func, const char *module, long ord,
   byte omfbuf[1024];
   int i, len;
   word page;
+  struct import *ip;
+
+  /* Collect the imports in a worker, or if the library will be created
+     after reading all input files (-p auto). */
 
+  if (cur_job != NULL || out_lib == NULL)
+    {
+      ip = xmalloc (sizeof (struct import));
+      ip->func = xstrdup (func);
+      ip->module = xstrdup (module);
+      ip->ord = ord;
+      ip->name = xstrdup (name);
+      ip->next = NULL;
+      if (cur_job != NULL)
+        {
+          *cur_job->imports_add = ip;
+          cur_job->imports_add = &ip->next;
+        }
+      else
+        {
+          *lib_imports_add = ip;
+          lib_imports_add = &ip->next;
+        }
+      return;
+    }
   if (omflib_write_module (out_lib, func, &page, lib_errmsg) != 0)
     lib_error ();
   if (omflib_add_pub (out_lib, func, page, lib_errmsg) != 0)
@@ -331,6 +606,77 @@ static void write_lib_import (const char *func, const char *module, long ord,
 }
 
 
+/* Return the size of the module written by write_lib_import() for the
+   import IP, without padding. */
+
+static long lib_import_size (const struct import *ip)
+{
+  long size;
+
+  size = 3 + 1 + strlen (ip->func) + 1;                 /* THEADR */
+  size += 3 + 4 + 1 + strlen (ip->func) + 1 + strlen (ip->module) + 1;
+  if (ip->ord < 1)                                      /* COMENT */
+    size += 1 + (strcmp (ip->func, ip->name) == 0 ? 0 : strlen (ip->name));
+  else
+    size += 2;
+  size += 3 + 1 + 1;                                    /* MODEND */
+  return size;
+}
+
+
+/* Return the smallest page size for which the modules of the imports
+   collected in lib_imports can be addressed by 16-bit page numbers.
+   This page size gives the smallest library, as modules are padded
+   to a multiple of the page size.  Report the padding unless -q is
+   given. */
+
+static int auto_page_size (void)
+{
+  const struct import *ip;
+  long pages, size, data;
+  int page_size;
+
+  for (page_size = 16; page_size <= 32768; page_size *= 2)
+    {
+      pages = 1;                /* Library header */
+      data = 0;
+      for (ip = lib_imports; ip != NULL && pages <= 65535; ip = ip->next)
+        {
+          size = lib_import_size (ip);
+          pages += (size + page_size - 1) / page_size;
+          data += size;
+        }
+      if (ip == NULL)
+        {
+          if (!opt_q)
+            information ("Page size %d, %ld of %ld bytes of modules "
+                         "are padding", page_size,
+                         (pages - 1) * page_size - data,
+                         (pages - 1) * page_size);
+          return page_size;
+        }
+    }
+  error ("Too many modules for a library");
+}
+
+
+/* Write the imports collected in lib_imports to the library. */
+
+static void write_lib_imports (void)
+{
+  struct import *ip1, *ip2;
+
+  for (ip1 = lib_imports; ip1 != NULL; ip1 = ip2)
+    {
+      ip2 = ip1->next;
+      write_lib_import (ip1->func, ip1->module, ip1->ord, ip1->name);
+      free (ip1->func); free (ip1->module); free (ip1->name);
+      free (ip1);
+    }
+  lib_imports = NULL; lib_imports_add = &lib_imports;
+}
+
+
 #define DELIM(c) ((c) == 0 || isspace ((unsigned char)c))
 
 
@@ -344,7 +690,7 @@ static void read_imp (const char *fname)
   struct lib *lp1;
   struct predef *pp1;
 
-  libs = NULL; mod_lbl = 1;
+  free_libs ();
   inp_file = fopen (fname, "rt");
   if (inp_file == NULL)
     error ("Cannot open input file `%s'", fname);
@@ -380,7 +726,7 @@ static void read_imp (const char *fname)
         ;           /* empty line */
       else
         {
-          if (!opt_b && out_file == NULL && mode != M_IMP_TO_LIB)
+          if (!opt_b && out_file == NULL && mode == M_IMP_TO_S)
             error ("No output file selected in line %ld of %s",
                    line_no, fname);
           if (DELIM (*p))
@@ -488,6 +834,9 @@ static void read_imp (const char *fname)
             case M_IMP_TO_LIB:
               write_lib_import (func, module, ord, name);
               break;
+            case M_RESOLVE:
+              resolve_add (func, module, ord, (ord < 0 ? name : NULL));
+              break;
             case M_IMP_TO_S:
               if (opt_b)
                 {
@@ -503,9 +852,7 @@ static void read_imp (const char *fname)
                              base_len, module, file_no);
                   out_start ();
                 }
-              for (pp1 = predefs; pp1 != NULL; pp1 = pp1->next)
-                if (stricmp (module, pp1->name) == 0)
-                  break;
+              pp1 = find_predef (module);
               if (pp1 != NULL)
                 {
                   mod_type = MOD_PREDEF;
@@ -513,22 +860,22 @@ static void read_imp (const char *fname)
                 }
               else
                 {
-                  for (lp1 = libs; lp1 != NULL; lp1 = lp1->next)
-                    if (stricmp (module, lp1->name) == 0)
-                      break;
+                  lp1 = find_lib (module);
                   if (lp1 == NULL)
                     {
                       mod_type = MOD_DEF;
-                      lp1 = xmalloc (sizeof (struct lib));
-                      lp1->name = xstrdup (module);
-                      lp1->lbl = mod_lbl++;
-                      lp1->next = libs;
-                      libs = lp1;
+                      lp1 = add_lib (module);
                     }
                   else
                     mod_type = MOD_REF;
                   sprintf (mod_ref, "L%d", lp1->lbl);
                 }
+              if (obj_flag)
+                {
+                  obj_stub (func, module, ord, name, parms, mod_type,
+                            mod_ref, pp1, lp1);
+                  break;
+                }
               fprintf (out_file, "\n\t.globl\t_%s\n", func);
               fprintf (out_file, "\t.align\t2, %d\n", 0x90);
               fprintf (out_file, "_%s:\n", func);
@@ -574,46 +921,176 @@ static void set_ar (char *dst, const char *src, int size)
 }
 
 
-static long ar_member_size;
+/* Store the decimal representation of N left-justified in the field
+   DST of SIZE characters, padding with blanks. */
 
-static void write_ar (const char *name, long size)
+static void set_ar_num (char *dst, long n, int size)
 {
-  struct ar_hdr ar;
   char tmp[20];
+  int i;
+
+  i = sizeof (tmp);
+  do
+    {
+      tmp[--i] = (char)('0' + n % 10);
+      n /= 10;
+    } while (n != 0);
+  while (i < sizeof (tmp) && size > 0)
+    {
+      *dst++ = tmp[i++];
+      --size;
+    }
+  while (size > 0)
+    {
+      *dst++ = ' ';
+      --size;
+    }
+}
+
+
+/* Set the name of archive member AR to "IMPORT#N". */
+
+static void set_ar_import (struct ar_hdr *ar, long n)
+{
+  memcpy (ar->ar_name, "IMPORT#", 7);
+  set_ar_num (ar->ar_name + 7, n, sizeof (ar->ar_name) - 7);
+}
+
+
+/* The members of an a.out archive are built in this arena.  As the
+   symbol index precedes the members, the arena is written to the
+   output file by finish_archive() when all members are known.  A job
+   keeps its arena until it is spliced into the main thread's arena. */
+
+static THREAD_LOCAL char *ar_arena;
+static THREAD_LOCAL long ar_arena_len;
+static THREAD_LOCAL long ar_arena_size;
+
+/* The symbols defined by the members of the arena, for the symbol
+   index.  MEMBER is the offset of the member in the arena, NAME the
+   offset of the symbol name in ar_sym_str. */
+
+struct ar_sym
+{
+  long member;
+  long name;
+};
+
+static THREAD_LOCAL struct ar_sym *ar_sym_tab;
+static THREAD_LOCAL long ar_sym_count;
+static THREAD_LOCAL long ar_sym_alloc;
+static THREAD_LOCAL char *ar_sym_str;
+static THREAD_LOCAL long ar_sym_str_len;
+static THREAD_LOCAL long ar_sym_str_size;
+
+/* All member headers are copied from this template, which is set up
+   once by init_archive(). */
+
+static struct ar_hdr ar_template;
+
+static THREAD_LOCAL long ar_member_size;
+
+
+/* Append N bytes to the arena and return a pointer to them. */
+
+static char *ar_reserve (long n)
+{
+  char *p;
+
+  if (ar_arena_len + n > ar_arena_size)
+    {
+      ar_arena_size = (ar_arena_size == 0
+                       ? AR_ARENA_SIZE : 2 * ar_arena_size);
+      while (ar_arena_len + n > ar_arena_size)
+        ar_arena_size *= 2;
+      ar_arena = xrealloc (ar_arena, ar_arena_size);
+    }
+  p = ar_arena + ar_arena_len;
+  ar_arena_len += n;
+  return p;
+}
+
+
+/* Write the contents of the arena to the output file. */
+
+static void ar_flush (void)
+{
+  if (ar_arena_len != 0)
+    {
+      if (fwrite (ar_arena, 1, ar_arena_len, out_file) != ar_arena_len)
+        write_error (out_fname);
+      ar_arena_len = 0;
+    }
+}
+
+
+/* Add symbol NAME defined by the member at offset MEMBER of the arena
+   to the symbol index. */
+
+static void ar_add_sym (const char *name, long member)
+{
+  long len;
+
+  if (ar_sym_count >= ar_sym_alloc)
+    {
+      ar_sym_alloc = (ar_sym_alloc == 0 ? 1024 : 2 * ar_sym_alloc);
+      ar_sym_tab = xrealloc (ar_sym_tab,
+                             ar_sym_alloc * sizeof (*ar_sym_tab));
+    }
+  len = strlen (name) + 1;
+  if (ar_sym_str_len + len > ar_sym_str_size)
+    {
+      ar_sym_str_size = (ar_sym_str_size == 0 ? 0x4000 : 2 * ar_sym_str_size);
+      while (ar_sym_str_len + len > ar_sym_str_size)
+        ar_sym_str_size *= 2;
+      ar_sym_str = xrealloc (ar_sym_str, ar_sym_str_size);
+    }
+  ar_sym_tab[ar_sym_count].member = member;
+  ar_sym_tab[ar_sym_count].name = ar_sym_str_len;
+  ar_sym_count++;
+  memcpy (ar_sym_str + ar_sym_str_len, name, len);
+  ar_sym_str_len += len;
+}
+
+
+static void write_ar (long n, long size)
+{
+  struct ar_hdr *ar;
 
   ar_member_size = size;
-  set_ar (ar.ar_name, name, sizeof (ar.ar_name));
-  sprintf (tmp, "%ld", (long)time (NULL));
-  set_ar (ar.ar_date, tmp, sizeof (ar.ar_date));
-  set_ar (ar.ar_uid, "0", sizeof (ar.ar_uid));
-  set_ar (ar.ar_gid, "0", sizeof (ar.ar_gid));
-  set_ar (ar.ar_mode, "100666", sizeof (ar.ar_gid));
-  sprintf (tmp, "%ld", size);
-  set_ar (ar.ar_size, tmp, sizeof (ar.ar_size));
-  set_ar (ar.ar_fmag, ARFMAG, sizeof (ar.ar_fmag));
-  fwrite (&ar, 1, sizeof (ar), out_file);
+  ar = (struct ar_hdr *)ar_reserve (sizeof (*ar));
+  *ar = ar_template;
+  set_ar_import (ar, n);
+  set_ar_num (ar->ar_size, size, sizeof (ar->ar_size));
 }
 
 
 static void finish_ar (void)
 {
   if (ar_member_size & 1)
-    fputc (0, out_file);
+    *ar_reserve (1) = 0;
 }
 
 
-static dword aout_str_size;
-static char aout_str_tab[2048];
-static int aout_sym_count;
-static struct nlist aout_sym_tab[6];
+/* The tables of the a.out encoder grow as needed; they are kept
+   across objects. */
 
-static byte aout_text[64];
-static int aout_text_size;
+static THREAD_LOCAL dword aout_str_size;
+static THREAD_LOCAL dword aout_str_alloc;
+static THREAD_LOCAL char *aout_str_tab;
+static THREAD_LOCAL int aout_sym_count;
+static THREAD_LOCAL int aout_sym_alloc;
+static THREAD_LOCAL struct nlist *aout_sym_tab;
 
-static struct reloc aout_treloc_tab[2];
-static int aout_treloc_count;
+static THREAD_LOCAL byte *aout_text;
+static THREAD_LOCAL int aout_text_size;
+static THREAD_LOCAL int aout_text_alloc;
 
-static int aout_size;
+static THREAD_LOCAL struct reloc *aout_treloc_tab;
+static THREAD_LOCAL int aout_treloc_count;
+static THREAD_LOCAL int aout_treloc_alloc;
+
+static THREAD_LOCAL long aout_size;
 
 
 static void aout_init (void)
@@ -630,10 +1107,19 @@ static int aout_sym (const char *name, byte type, byte other,
   int len;
 
   len = strlen (name);
-  if (aout_str_size + len + 1 > sizeof (aout_str_tab))
-    error ("a.out string table overflow");
-  if (aout_sym_count >= sizeof (aout_sym_tab) / sizeof (aout_sym_tab[0]))
-    error ("a.out symbol table overflow");
+  if (aout_str_size + len + 1 > aout_str_alloc)
+    {
+      aout_str_alloc = (aout_str_alloc == 0 ? 2048 : 2 * aout_str_alloc);
+      while (aout_str_size + len + 1 > aout_str_alloc)
+        aout_str_alloc *= 2;
+      aout_str_tab = xrealloc (aout_str_tab, aout_str_alloc);
+    }
+  if (aout_sym_count >= aout_sym_alloc)
+    {
+      aout_sym_alloc = (aout_sym_alloc == 0 ? 8 : 2 * aout_sym_alloc);
+      aout_sym_tab = xrealloc (aout_sym_tab,
+                               aout_sym_alloc * sizeof (*aout_sym_tab));
+    }
   aout_sym_tab[aout_sym_count].string = aout_str_size;
   aout_sym_tab[aout_sym_count].type = type;
   aout_sym_tab[aout_sym_count].other = other;
@@ -647,8 +1133,11 @@ static int aout_sym (const char *name, byte type, byte other,
 
 static void aout_text_byte (byte b)
 {
-  if (aout_text_size >= sizeof (aout_text))
-    error ("a.out text segment overflow");
+  if (aout_text_size >= aout_text_alloc)
+    {
+      aout_text_alloc = (aout_text_alloc == 0 ? 64 : 2 * aout_text_alloc);
+      aout_text = xrealloc (aout_text, aout_text_alloc);
+    }
   aout_text[aout_text_size++] = b;
 }
 
@@ -665,8 +1154,13 @@ static void aout_text_dword (dword d)
 static void aout_treloc (dword address, int symbolnum, int pcrel, int length,
                          int ext)
 {
-  if (aout_treloc_count >= sizeof (aout_treloc_tab) / sizeof (struct reloc))
-    error ("a.out text relocation buffer overflow");
+  if (aout_treloc_count >= aout_treloc_alloc)
+    {
+      aout_treloc_alloc = (aout_treloc_alloc == 0
+                           ? 4 : 2 * aout_treloc_alloc);
+      aout_treloc_tab = xrealloc (aout_treloc_tab,
+                                  aout_treloc_alloc * sizeof (struct reloc));
+    }
   aout_treloc_tab[aout_treloc_count].address = address;
   aout_treloc_tab[aout_treloc_count].symbolnum = symbolnum;
   aout_treloc_tab[aout_treloc_count].pcrel = pcrel;
@@ -688,7 +1182,9 @@ static void aout_finish (void)
 }
 
 
-static void aout_write (void)
+/* Store the a.out object (AOUT_SIZE bytes) at P. */
+
+static void aout_write (char *p)
 {
   struct a_out_header ao;
 
@@ -702,27 +1198,34 @@ static void aout_write (void)
   ao.entry = 0;
   ao.trsize = aout_treloc_count * sizeof (struct reloc);
   ao.drsize = 0;
-  fwrite (&ao, 1, sizeof (ao), out_file);
-  fwrite (aout_text, 1, aout_text_size, out_file);
-  fwrite (aout_treloc_tab, aout_treloc_count, sizeof (struct reloc), out_file);
-  fwrite (aout_sym_tab, aout_sym_count, sizeof (aout_sym_tab[0]), out_file);
-  *(dword *)aout_str_tab = aout_str_size;
-  fwrite (aout_str_tab, 1, aout_str_size, out_file);
+  memcpy (p, &ao, sizeof (ao)); p += sizeof (ao);
+  memcpy (p, aout_text, aout_text_size); p += aout_text_size;
+  memcpy (p, aout_treloc_tab, aout_treloc_count * sizeof (struct reloc));
+  p += aout_treloc_count * sizeof (struct reloc);
+  memcpy (p, aout_sym_tab, aout_sym_count * sizeof (aout_sym_tab[0]));
+  p += aout_sym_count * sizeof (aout_sym_tab[0]);
+  memcpy (p, &aout_str_size, sizeof (aout_str_size));
+  if (aout_str_size > sizeof (dword))
+    memcpy (p + sizeof (dword), aout_str_tab + sizeof (dword),
+            aout_str_size - sizeof (dword));
 }
 
 
 static void write_a_import (const char *func_name, const char *mod_name,
                             int ordinal, const char *proc_name)
 {
-  char tmp1[256], tmp2[257], tmp3[1024];
+  char tmp2[257], tmp3[1024];
   int sym_mcount, sym_entry, sym_import;
   dword fixup_mcount, fixup_import;
+  long member;
 
   aout_init ();
+  member = ar_arena_len;
   sprintf (tmp2, "_%s", func_name);
   if (profile_flag && strncmp (func_name, "_16_", 4) != 0)
     {
       sym_entry = aout_sym (tmp2, N_TEXT|N_EXT, 0, 0, aout_text_size);
+      ar_add_sym (tmp2, member);
       sym_mcount = aout_sym ("__mcount", N_EXT, 0, 0, 0);
 
       /* Use, say, "_$U_DosRead" for "DosRead" to import the
@@ -744,68 +1247,239 @@ static void write_a_import (const char *func_name, const char *mod_name,
       aout_treloc (fixup_mcount, sym_mcount, 1, 2, 1);
       aout_treloc (fixup_import, sym_import, 1, 2, 1);
     }
-  sprintf (tmp1, "IMPORT#%ld", seq_no);
   if (proc_name == NULL)
     sprintf (tmp3, "%s=%s.%d", tmp2, mod_name, ordinal);
   else
     sprintf (tmp3, "%s=%s.%s", tmp2, mod_name, proc_name);
   aout_sym (tmp2, N_IMP1|N_EXT, 0, 0, 0);
   aout_sym (tmp3, N_IMP2|N_EXT, 0, 0, 0);
+  ar_add_sym (tmp2, member);
   aout_finish ();
-  write_ar (tmp1, aout_size);
-  aout_write ();
+  if (cur_job != NULL)
+    {
+      if (cur_job->member_count >= cur_job->member_alloc)
+        {
+          cur_job->member_alloc += 256;
+          cur_job->members = xrealloc (cur_job->members,
+                                       (cur_job->member_alloc
+                                        * sizeof (*cur_job->members)));
+        }
+      cur_job->members[cur_job->member_count++] = member;
+    }
+  write_ar (seq_no, aout_size);
+  aout_write (ar_reserve (aout_size));
   finish_ar ();
   seq_no++;
-  if (ferror (out_file))
-    write_error (out_fname);
 }
 
 
-static void read_lib (const char *fname)
+static void aout_text_string (const char *str)
 {
-  FILE *inp_file;
-  int n, i, next, more, impure_warned, ord_flag;
-  unsigned char *buf;
-#pragma pack(1)
-  struct record
+  do
+    aout_text_byte ((byte)*str);
+  while (*str++ != 0);
+}
+
+
+/* Symbol number of __os2_bad in the current object, or -1. */
+
+static THREAD_LOCAL int os2_bad_sym;
+
+/* Start an a.out object for the stubs of M_IMP_TO_S, -a without
+   assembler. */
+
+static void obj_start (void)
+{
+  struct predef *pp1;
+
+  aout_init ();
+  os2_bad_sym = -1;
+  for (pp1 = predefs; pp1 != NULL; pp1 = pp1->next)
+    pp1->sym = -1;
+}
+
+
+/* Add to the current object the code which the assembler creates for
+   the stub written by read_imp().  MOD_REF is the name of the
+   external symbol for MOD_PREDEF. */
+
+static void obj_stub (const char *func, const char *module, long ord,
+                      const char *name, long parms, int mod_type,
+                      const char *mod_ref, struct predef *pp1,
+                      struct lib *lp1)
+{
+  char tmp[257];
+  dword lbl1, lbl2, next;
+
+  while (aout_text_size & 3)
+    aout_text_byte (0x90);
+  sprintf (tmp, "_%s", func);
+  aout_sym (tmp, N_TEXT|N_EXT, 0, 0, aout_text_size);
+  if (parms >= 0)
     {
-      unsigned char type;
-      unsigned short length;
-    } record, *rec_ptr;
-#pragma pack()
-  unsigned char func_name[256];
-  unsigned char mod_name[256];
-  unsigned char proc_name[256];
-  unsigned char theadr_name[256];
-  int ordinal;
-  long pos, size;
-  int page_size;
+      aout_text_byte (0xb0);    /* movb $parms, %al */
+      aout_text_byte ((byte)parms);
+    }
+  if (os2_bad_sym == -1)
+    os2_bad_sym = aout_sym ("__os2_bad", N_EXT, 0, 0, 0);
+  lbl1 = aout_text_size;
+  aout_text_byte (0xe9);        /* 1: jmp __os2_bad */
+  aout_treloc (aout_text_size, os2_bad_sym, 1, 2, 1);
+  aout_text_dword (0 - (aout_text_size + 4));
+
+  /* 2: .long ord >= 0, 1b+1, module, ord or 4f */
+
+  lbl2 = aout_text_size;
+  next = lbl2 + 4 * 4;
+  aout_text_dword (ord >= 0 ? 1 : 0);
+  aout_treloc (aout_text_size, N_TEXT, 0, 2, 0);
+  aout_text_dword (lbl1 + 1);
+  if (mod_type == MOD_PREDEF)
+    {
+      if (pp1->sym == -1)
+        pp1->sym = aout_sym (mod_ref, N_EXT, 0, 0, 0);
+      aout_treloc (aout_text_size, pp1->sym, 0, 2, 1);
+      aout_text_dword (0);
+    }
+  else
+    {
+      if (mod_type == MOD_DEF)
+        {
+          lp1->addr = next;
+          next += strlen (module) + 1;
+        }
+      aout_treloc (aout_text_size, N_TEXT, 0, 2, 0);
+      aout_text_dword (lp1->addr);
+    }
+  if (ord >= 0)
+    aout_text_dword (ord);
+  else
+    {
+      aout_treloc (aout_text_size, N_TEXT, 0, 2, 0);
+      aout_text_dword (next);
+    }
+  if (mod_type == MOD_DEF)
+    aout_text_string (module);
+  if (ord < 0)
+    aout_text_string (name);
+  aout_sym ("__os2dll", N_SETT|N_EXT, 0, 0, lbl2);
+}
 
-  if (mode == M_LIB_TO_IMP)
-    fprintf (out_file, "; -------- %s --------\n", fname);
-  if (ferror (out_file))
+
+/* Write the current object to OUT_FILE. */
+
+static void obj_finish (void)
+{
+  char *buf;
+
+  aout_finish ();
+  buf = xmalloc (aout_size);
+  aout_write (buf);
+  if (fwrite (buf, 1, aout_size, out_file) != aout_size)
     write_error (out_fname);
-  inp_file = fopen (fname, "rb");
-  if (inp_file == NULL)
-    error ("Cannot open input file `%s'", fname);
-  if (fread (&record, sizeof (record), 1, inp_file) != 1)
+  free (buf);
+}
+
+
+/* Make the first SIZE bytes of the input file F available in memory.
+   Map the file if possible, so that the records can be walked
+   straight out of the page cache.  Otherwise, read the file into a
+   buffer.  Set *MAPPED to TRUE iff the file has been mapped.  Return
+   NULL on read error. */
+
+static const unsigned char *map_input (FILE *f, long size, int *mapped)
+{
+  unsigned char *buf;
+
+#if defined (USE_MMAP)
+  void *p;
+
+  p = mmap (NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fileno (f), 0);
+  if (p != MAP_FAILED)
+    {
+#if defined (MADV_SEQUENTIAL)
+      madvise (p, (size_t)size, MADV_SEQUENTIAL);
+#endif
+      *mapped = TRUE;
+      return p;
+    }
+#endif
+  *mapped = FALSE;
+  buf = xmalloc (size);
+  if (fseek (f, 0L, SEEK_SET) != 0
+      || fread (buf, 1, size, f) != size)
+    {
+      free (buf);
+      return NULL;
+    }
+  return buf;
+}
+
+
+static void unmap_input (const unsigned char *buf, long size, int mapped)
+{
+#if defined (USE_MMAP)
+  if (mapped)
+    {
+      munmap ((void *)buf, (size_t)size);
+      return;
+    }
+#endif
+  free ((void *)buf);
+}
+
+
+static void read_lib (const char *fname)
+{
+  FILE *inp_file;
+  int n, i, next, more, impure_warned, ord_flag, mapped;
+  const unsigned char *buf;
+#pragma pack(1)
+  struct record
+    {
+      unsigned char type;
+      unsigned short length;
+    } record;
+  const struct record *rec_ptr;
+#pragma pack()
+  unsigned char func_name[256];
+  unsigned char mod_name[256];
+  unsigned char proc_name[256];
+  unsigned char theadr_name[256];
+  int ordinal;
+  long pos, size, map_size;
+  int page_size;
+
+  if (mode == M_LIB_TO_IMP)
+    {
+      fprintf (out_file, "; -------- %s --------\n", fname);
+      if (ferror (out_file))
+        write_error (out_fname);
+    }
+  inp_file = fopen (fname, "rb");
+  if (inp_file == NULL)
+    error ("Cannot open input file `%s'", fname);
+  if (fseek (inp_file, 0L, SEEK_END) != 0)
     goto read_error;
+  map_size = ftell (inp_file);
+  if (map_size < (long)sizeof (record) + 4)
+    goto read_error;
+  buf = map_input (inp_file, map_size, &mapped);
+  if (buf == NULL)
+    goto read_error;
+  record.type = buf[0];
+  record.length = buf[1] | (buf[2] << 8);
   if (record.type != LIBHDR || record.length < 5)
     error ("`%s' is not a library file", fname);
   page_size = record.length + 3;
-  if (fread (&pos, sizeof (pos), 1, inp_file) != 1)
-    goto read_error;
-  if (fseek (inp_file, 0L, SEEK_END) != 0)
-    goto read_error;
-  size = ftell (inp_file);
+
+  /* The records end where the dictionary starts. */
+
+  pos = (buf[3] | (buf[4] << 8) | (buf[5] << 16)
+         | ((unsigned long)buf[6] << 24));
+  size = map_size;
   if (pos < size)
     size = pos;
-  buf = xmalloc (size);
-  if (fseek (inp_file, 0L, SEEK_SET) != 0)
-    goto read_error;
-  size = fread (buf, 1, size, inp_file);
-  if (size == 0 || ferror (inp_file))
-    goto read_error;
   i = 0; more = TRUE; impure_warned = FALSE; theadr_name[0] = 0;
   while (more)
     {
@@ -814,6 +1488,14 @@ static void read_lib (const char *fname)
       if (i > size) goto bad;
       next = i + rec_ptr->length;
       if (next > size) goto bad;
+
+      /* A checksum byte of zero means that there is no checksum. */
+
+      if (opt_c && rec_ptr->length != 0 && buf[next-1] != 0
+          && omflib_byte_sum (buf + i - sizeof (struct record),
+                              next - i + sizeof (struct record)) != 0)
+        error ("Checksum error in record at offset %ld of `%s'",
+               (long)(i - sizeof (struct record)), fname);
       switch (rec_ptr->type)
         {
         case MODEND:
@@ -893,6 +1575,12 @@ static void read_lib (const char *fname)
                   else
                     write_a_import (func_name, mod_name, ordinal, NULL);
                   break;
+                case M_RESOLVE:
+                  resolve_add ((const char *)func_name,
+                               (const char *)mod_name, ordinal,
+                               (ordinal == -1
+                                ? (const char *)proc_name : NULL));
+                  break;
                 default:
                   abort ();
                 }
@@ -921,7 +1609,7 @@ static void read_lib (const char *fname)
         }
       i = next;
     }
-  free (buf);
+  unmap_input (buf, map_size, mapped);
   fclose (inp_file);
   return;
 
@@ -956,108 +1644,967 @@ static void init_archive (void)
 {
   static char ar_magic[SARMAG+1] = ARMAG;
 
+  set_ar (ar_template.ar_name, "", sizeof (ar_template.ar_name));
+  set_ar_num (ar_template.ar_date, (long)time (NULL),
+              sizeof (ar_template.ar_date));
+  set_ar (ar_template.ar_uid, "0", sizeof (ar_template.ar_uid));
+  set_ar (ar_template.ar_gid, "0", sizeof (ar_template.ar_gid));
+  set_ar (ar_template.ar_mode, "100666", sizeof (ar_template.ar_mode));
+  set_ar (ar_template.ar_size, "", sizeof (ar_template.ar_size));
+  set_ar (ar_template.ar_fmag, ARFMAG, sizeof (ar_template.ar_fmag));
   fwrite (ar_magic, 1, SARMAG, out_file);
 }
 
 
-static int md_export (struct _md *md, const _md_stmt *stmt, _md_token token,
-                      void *arg)
+static char *ar_put_dword (char *dst, dword x)
 {
-  const char *internal;
+  memcpy (dst, &x, sizeof (x));
+  return dst + sizeof (x);
+}
+
+
+/* Write the symbol index and the members of the archive.  The index is
+   a BSD-style __.SYMDEF member: the size of the ranlib table in bytes,
+   the ranlib table of (string offset, member offset) pairs, the size of
+   the string table and the string table. */
+
+static void finish_archive (void)
+{
+  struct ar_hdr ar;
+  char *map, *p;
+  dword ranlib_size, str_size, map_size, first;
+  long i;
+
+  if (ar_sym_count != 0)
+    {
+      ranlib_size = ar_sym_count * 2 * sizeof (dword);
+      str_size = (ar_sym_str_len + 1) & ~1;
+      map_size = sizeof (dword) + ranlib_size + sizeof (dword) + str_size;
+      first = SARMAG + sizeof (ar) + map_size;
+      ar = ar_template;
+      set_ar (ar.ar_name, AR_SYMDEF, sizeof (ar.ar_name));
+      set_ar_num (ar.ar_size, map_size, sizeof (ar.ar_size));
+      map = xmalloc (sizeof (ar) + map_size);
+      memcpy (map, &ar, sizeof (ar));
+      p = ar_put_dword (map + sizeof (ar), ranlib_size);
+      for (i = 0; i < ar_sym_count; ++i)
+        {
+          p = ar_put_dword (p, ar_sym_tab[i].name);
+          p = ar_put_dword (p, first + ar_sym_tab[i].member);
+        }
+      p = ar_put_dword (p, str_size);
+      memcpy (p, ar_sym_str, ar_sym_str_len);
+      if (str_size != ar_sym_str_len)
+        p[ar_sym_str_len] = 0;
+      if (fwrite (map, 1, sizeof (ar) + map_size, out_file)
+          != sizeof (ar) + map_size)
+        write_error (out_fname);
+      free (map);
+    }
+  ar_flush ();
+}
+
+
+/* A cache file of -k holds the LIBRARY statements and EXPORTS entries
+   of a module definition file, in the order of the file.  It is named
+   after two hash codes of the contents of the .def file and consists
+   of a header, the records, and the string table.  All names are
+   offsets into the string table.  The file is not portable between
+   hosts of different byte order. */
+
+struct def_cache_header
+{
+  char magic[8];                /* DEF_CACHE_MAGIC */
+  char version[8];              /* VERSION of emximp */
+  dword format;                 /* DEF_CACHE_FORMAT */
+  dword def_size;               /* Size of the .def file */
+  dword def_hash[2];            /* Hash codes of the .def file */
+  dword rec_count;              /* Number of records */
+  dword str_size;               /* Size of the string table */
+  dword check;                  /* Hash code of records and strings */
+};
+
+struct def_cache_rec
+{
+  dword entry;                  /* Entry name or module name */
+  dword internal;               /* Internal name or DEF_CACHE_NONE */
+  dword ordinal;
+  dword pwords;
+  dword flags;                  /* _MDEP_* or DEF_CACHE_LIBRARY */
+};
+
+/* The records of the .def file being parsed, if it is to be cached. */
+
+static THREAD_LOCAL int dc_record;
+static THREAD_LOCAL struct def_cache_rec *dc_tab;
+static THREAD_LOCAL long dc_count;
+static THREAD_LOCAL long dc_alloc;
+static THREAD_LOCAL char *dc_str;
+static THREAD_LOCAL long dc_str_len;
+static THREAD_LOCAL long dc_str_size;
 
+
+/* Compute a hash code of the N bytes at P, starting with H and using
+   the multiplier M.  Four bytes are processed at a time. */
+
+static dword block_hash (const unsigned char *p, long n, dword h, dword m)
+{
+  while (n >= 4)
+    {
+      h = (h ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((dword)p[3] << 24))) * m;
+      h ^= h >> 16;
+      p += 4; n -= 4;
+    }
+  while (n-- > 0)
+    h = (h ^ *p++) * m;
+  return h;
+}
+
+
+/* Compute the two hash codes of the N bytes at P which identify a .def
+   file in the cache. */
+
+static void def_hash (const unsigned char *p, long n, dword *hash)
+{
+  hash[0] = block_hash (p, n, 2166136261U, 16777619);
+  hash[1] = block_hash (p, n, 0, 2654435761U);
+}
+
+
+/* Build the name of the cache file for a .def file of SIZE bytes with
+   hash codes HASH. */
+
+static void def_cache_name (char *dst, long size, const dword *hash)
+{
+  size_t len;
+
+  len = strlen (cache_dir);
+  memcpy (dst, cache_dir, len);
+  if (len != 0 && strchr ("/\\:", cache_dir[len-1]) == NULL)
+    dst[len++] = '/';
+  sprintf (dst + len, "%08lx%08lx%06lx.mdc", (unsigned long)hash[0],
+           (unsigned long)hash[1], (unsigned long)size & 0xffffff);
+}
+
+
+/* Add the string S to the string table of the cache file being built
+   and return its offset. */
+
+static dword def_cache_str (const char *s)
+{
+  long len, start;
+
+  len = strlen (s) + 1;
+  if (dc_str_len + len > dc_str_size)
+    {
+      dc_str_size = (dc_str_size == 0 ? 0x4000 : 2 * dc_str_size);
+      if (dc_str_size < dc_str_len + len)
+        dc_str_size = dc_str_len + len;
+      dc_str = xrealloc (dc_str, dc_str_size);
+    }
+  start = dc_str_len;
+  memcpy (dc_str + dc_str_len, s, len);
+  dc_str_len += len;
+  return start;
+}
+
+
+/* Add a record to the cache file being built.  INTERNAL is NULL if no
+   internal name is given. */
+
+static void def_cache_add (const char *entry, const char *internal,
+                           int ordinal, int pwords, dword flags)
+{
+  struct def_cache_rec *r;
+
+  if (dc_count >= dc_alloc)
+    {
+      dc_alloc = (dc_alloc == 0 ? 1024 : 2 * dc_alloc);
+      dc_tab = xrealloc (dc_tab, dc_alloc * sizeof (*dc_tab));
+    }
+  r = &dc_tab[dc_count++];
+  r->entry = def_cache_str (entry);
+  if (internal == NULL)
+    r->internal = DEF_CACHE_NONE;
+  else if (internal == entry)
+    r->internal = r->entry;
+  else
+    r->internal = def_cache_str (internal);
+  r->ordinal = ordinal;
+  r->pwords = pwords;
+  r->flags = flags;
+}
+
+
+/* Write the records collected for a .def file of SIZE bytes with hash
+   codes HASH to the cache file CNAME.  The file is written under a
+   temporary name first so that other processes never see a partial
+   file.  Errors are ignored, the cache file just won't be used. */
+
+static void write_def_cache (const char *cname, long size, const dword *hash)
+{
+  struct def_cache_header hdr;
+  char tmp[512 + 32];           /* CNAME is shorter than 512 bytes */
+  FILE *f;
+  int ok;
+
+  memset (&hdr, 0, sizeof (hdr));
+  memcpy (hdr.magic, DEF_CACHE_MAGIC, sizeof (DEF_CACHE_MAGIC));
+  strncpy (hdr.version, VERSION, sizeof (hdr.version));
+  hdr.format = DEF_CACHE_FORMAT;
+  hdr.def_size = size;
+  hdr.def_hash[0] = hash[0]; hdr.def_hash[1] = hash[1];
+  hdr.rec_count = dc_count;
+  hdr.str_size = dc_str_len;
+  hdr.check = block_hash ((const unsigned char *)dc_tab,
+                          dc_count * sizeof (*dc_tab), 2166136261U,
+                          16777619);
+  hdr.check = block_hash ((const unsigned char *)dc_str, dc_str_len,
+                          hdr.check, 16777619);
+  /* Jobs running in parallel may write the same cache file. */
+
+  snprintf (tmp, sizeof (tmp), "%s.%d.%d", cname, (int)getpid (),
+            (cur_job != NULL ? cur_job->index : 0));
+  f = fopen (tmp, "wb");
+  if (f == NULL)
+    return;
+  ok = (fwrite (&hdr, sizeof (hdr), 1, f) == 1
+        && fwrite (dc_tab, sizeof (*dc_tab), dc_count, f) == dc_count
+        && fwrite (dc_str, 1, dc_str_len, f) == dc_str_len);
+  if (fclose (f) != 0)
+    ok = FALSE;
+  if (ok)
+    {
+      if (rename (tmp, cname) == 0)
+        return;
+      remove (cname);           /* rename() may not replace files */
+      if (rename (tmp, cname) == 0)
+        return;
+    }
+  remove (tmp);
+}
+
+
+/* Check the cache file of BUF and CACHE_SIZE bytes for a .def file of
+   SIZE bytes with hash codes HASH. */
+
+static int check_def_cache (const unsigned char *buf, long cache_size,
+                            long size, const dword *hash)
+{
+  const struct def_cache_header *hdr;
+  const struct def_cache_rec *r;
+  const char *str;
+  dword i, check;
+
+  if (cache_size < sizeof (*hdr))
+    return FALSE;
+  hdr = (const struct def_cache_header *)buf;
+  if (memcmp (hdr->magic, DEF_CACHE_MAGIC, sizeof (DEF_CACHE_MAGIC)) != 0
+      || strncmp (hdr->version, VERSION, sizeof (hdr->version)) != 0
+      || hdr->format != DEF_CACHE_FORMAT || hdr->def_size != size
+      || hdr->def_hash[0] != hash[0] || hdr->def_hash[1] != hash[1]
+      || hdr->rec_count > (cache_size - sizeof (*hdr)) / sizeof (*r)
+      || (cache_size != sizeof (*hdr) + hdr->rec_count * sizeof (*r)
+                        + hdr->str_size))
+    return FALSE;
+  r = (const struct def_cache_rec *)(hdr + 1);
+  str = (const char *)(r + hdr->rec_count);
+  if (hdr->str_size != 0 && str[hdr->str_size-1] != 0)
+    return FALSE;
+  for (i = 0; i < hdr->rec_count; ++i)
+    if (r[i].entry >= hdr->str_size
+        || (r[i].internal != DEF_CACHE_NONE
+            && r[i].internal >= hdr->str_size))
+      return FALSE;
+  check = block_hash ((const unsigned char *)r, hdr->rec_count * sizeof (*r),
+                      2166136261U, 16777619);
+  check = block_hash ((const unsigned char *)str, hdr->str_size, check,
+                      16777619);
+  return check == hdr->check;
+}
+
+
+static int md_exports (struct _md *md, const _md_export *exports, int count,
+                       void *arg);
+
+/* Process the .def file FNAME of SIZE bytes with hash codes HASH by
+   reading the cache file CNAME.  Return FALSE if there is no valid
+   cache file. */
+
+static int read_def_cache (const char *fname, const char *cname, long size,
+                           const dword *hash)
+{
+  FILE *f;
+  const unsigned char *buf;
+  const struct def_cache_header *hdr;
+  const struct def_cache_rec *r;
+  const char *str;
+  _md_export tab[256];
+  long cache_size;
+  dword i;
+  int mapped, n;
+
+  f = fopen (cname, "rb");
+  if (f == NULL)
+    return FALSE;
+  if (fseek (f, 0L, SEEK_END) != 0 || (cache_size = ftell (f)) == -1
+      || cache_size == 0
+      || (buf = map_input (f, cache_size, &mapped)) == NULL)
+    {
+      fclose (f);
+      return FALSE;
+    }
+  if (!check_def_cache (buf, cache_size, size, hash))
+    {
+      unmap_input (buf, cache_size, mapped);
+      fclose (f);
+      return FALSE;
+    }
+  hdr = (const struct def_cache_header *)buf;
+  r = (const struct def_cache_rec *)(hdr + 1);
+  str = (const char *)(r + hdr->rec_count);
+  n = 0;
+  for (i = 0; i < hdr->rec_count; ++i, ++r)
+    {
+      if (n == sizeof (tab) / sizeof (tab[0])
+          || (n != 0 && (r->flags & DEF_CACHE_LIBRARY)))
+        {
+          md_exports (NULL, tab, n, (void *)fname);
+          n = 0;
+        }
+      if (r->flags & DEF_CACHE_LIBRARY)
+        module_name = xstrdup (str + r->entry);
+      else
+        {
+          tab[n].entryname = str + r->entry;
+          tab[n].internalname = (r->internal == DEF_CACHE_NONE
+                                 ? NULL : str + r->internal);
+          tab[n].ordinal = r->ordinal;
+          tab[n].pwords = r->pwords;
+          tab[n].flags = r->flags;
+          tab[n].linenumber = 0;
+          ++n;
+        }
+    }
+  if (n != 0)
+    md_exports (NULL, tab, n, (void *)fname);
+  unmap_input (buf, cache_size, mapped);
+  fclose (f);
+  return TRUE;
+}
+
+
+static int md_stmt (struct _md *md, const _md_stmt *stmt, _md_token token,
+                    void *arg)
+{
   switch (token)
     {
     case _MD_LIBRARY:
       module_name = xstrdup (stmt->library.name);
+      if (dc_record)
+        def_cache_add (stmt->library.name, NULL, 0, 0, DEF_CACHE_LIBRARY);
       break;
-    case _MD_EXPORTS:
-      if (module_name == NULL)
-        error ("No module name given in module definition file");
-      if (stmt->export.internalname[0] != 0)
-        internal = stmt->export.internalname;
-      else
-        internal = stmt->export.entryname;
+    case _MD_parseerror:
+      error ("%s (line %ld of %s)", _md_errmsg (stmt->error.code),
+             _md_get_linenumber (md), (const char *)arg);
+      break;
+    default:
+      break;
+    }
+  return 0;
+}
+
+
+static int md_exports (struct _md *md, const _md_export *exports, int count,
+                       void *arg)
+{
+  const _md_export *exp;
+  const char *internal;
+  int i;
+
+  if (module_name == NULL)
+    error ("No module name given in module definition file");
+  for (i = 0, exp = exports; i < count; ++i, ++exp)
+    {
+      if (dc_record)
+        def_cache_add (exp->entryname, exp->internalname, exp->ordinal,
+                       exp->pwords, exp->flags);
+      internal = (exp->internalname != NULL
+                  ? exp->internalname : exp->entryname);
       switch (mode)
         {
         case M_DEF_TO_IMP:
-          if (stmt->export.flags & _MDEP_ORDINAL)
+          if (exp->flags & _MDEP_ORDINAL)
             fprintf (out_file, "%-23s %-8s %3u ?\n",
-                     stmt->export.entryname, module_name,
-                     (unsigned)stmt->export.ordinal);
+                     exp->entryname, module_name, (unsigned)exp->ordinal);
           else
             fprintf (out_file, "%-23s %-8s %-23s ?\n",
-                     stmt->export.entryname, module_name, internal);
-          if (ferror (out_file))
-            write_error (out_fname);
+                     exp->entryname, module_name, internal);
           break;
         case M_DEF_TO_A:
-          if (stmt->export.flags & _MDEP_ORDINAL)
-            write_a_import (stmt->export.entryname, module_name,
-                            stmt->export.ordinal, NULL);
+          if (exp->flags & _MDEP_ORDINAL)
+            write_a_import (exp->entryname, module_name,
+                            exp->ordinal, NULL);
           else
-            write_a_import (stmt->export.entryname, module_name,
-                            0, internal);
+            write_a_import (exp->entryname, module_name, 0, internal);
           break;
         case M_DEF_TO_LIB:
-          write_lib_import (stmt->export.entryname, module_name,
-                            stmt->export.ordinal, internal);
+          write_lib_import (exp->entryname, module_name,
+                            exp->ordinal, internal);
+          break;
+        case M_RESOLVE:
+          if (exp->flags & _MDEP_ORDINAL)
+            resolve_add (exp->entryname, module_name, exp->ordinal, NULL);
+          else
+            resolve_add (exp->entryname, module_name, 0, internal);
           break;
         default:
           abort ();
         }
-      break;
-    case _MD_parseerror:
-      error ("%s (line %ld of %s)", _md_errmsg (stmt->error.code),
-             _md_get_linenumber (md), (const char *)arg);
-      break;
-    default:
-      break;
     }
+  if (mode == M_DEF_TO_IMP && ferror (out_file))
+    write_error (out_fname);
   return 0;
 }
 
 
 static void read_def (const char *fname)
 {
+  FILE *inp_file;
   struct _md *md;
+  const unsigned char *buf;
+  char cname[512];
+  dword hash[2];
+  long size;
+  int mapped;
 
   module_name = NULL;
-  md = _md_open (fname);
-  if (md == NULL)
+  inp_file = fopen (fname, "rb");
+  if (inp_file == NULL)
     error ("Cannot open input file `%s'", fname);
+  if (fseek (inp_file, 0L, SEEK_END) != 0
+      || (size = ftell (inp_file)) == -1
+      || (buf = map_input (inp_file, size, &mapped)) == NULL)
+    error ("Read error on input file `%s'", fname);
   if (mode == M_DEF_TO_IMP)
     {
       fprintf (out_file, "; -------- %s --------\n", fname);
       if (ferror (out_file))
         write_error (out_fname);
     }
+  if (cache_dir != NULL)
+    {
+      if (strlen (cache_dir) + 64 > sizeof (cname))
+        error ("Cache directory name too long");
+      def_hash (buf, size, hash);
+      def_cache_name (cname, size, hash);
+      if (read_def_cache (fname, cname, size, hash))
+        {
+          unmap_input (buf, size, mapped);
+          fclose (inp_file);
+          return;
+        }
+      dc_record = TRUE; dc_count = 0; dc_str_len = 0;
+    }
+  md = _md_use_buffer ((const char *)buf, size);
+  if (md == NULL)
+    error ("Out of memory");
+  if (cur_job == NULL)
+    _md_set_threads (md, jobs);
   _md_next_token (md);
-  _md_parse (md, md_export, (void *)fname);
+  _md_parse_batch (md, md_stmt, md_exports, (void *)fname);
   _md_close (md);
+  if (dc_record)
+    {
+      write_def_cache (cname, size, hash);
+      dc_record = FALSE;
+    }
+  unmap_input (buf, size, mapped);
+  fclose (inp_file);
+}
+
+
+/* Add the string S to the strings of the resolver table and return
+   its offset. */
+
+static long rs_add_str (const char *s)
+{
+  long len, start;
+
+  len = strlen (s) + 1;
+  if (rs_str_len + len > rs_str_size)
+    {
+      rs_str_size = (rs_str_size == 0 ? 0x10000 : 2 * rs_str_size);
+      if (rs_str_size < rs_str_len + len)
+        rs_str_size = rs_str_len + len;
+      rs_str = xrealloc (rs_str, rs_str_size);
+    }
+  start = rs_str_len;
+  memcpy (rs_str + rs_str_len, s, len);
+  rs_str_len += len;
+  return start;
+}
+
+
+/* Return the slot of the resolver table for the symbol NAME with hash
+   code H: the entry of NAME or the empty slot for inserting NAME. */
+
+static struct rs_entry *rs_lookup (const char *name, dword h)
+{
+  struct rs_entry *e;
+  long i;
+
+  for (i = h & (rs_size - 1);; i = (i + 1) & (rs_size - 1))
+    {
+      e = &rs_tab[i];
+      if (e->name == -1
+          || (e->hash == h && strcmp (rs_str + e->name, name) == 0))
+        return e;
+    }
+}
+
+
+/* Double the size of the resolver table. */
+
+static void rs_grow (void)
+{
+  struct rs_entry *old;
+  long i, j, old_size;
+
+  old = rs_tab; old_size = rs_size;
+  rs_size = (old_size == 0 ? RS_INIT_SIZE : 2 * old_size);
+  rs_tab = xmalloc (rs_size * sizeof (*rs_tab));
+  for (i = 0; i < rs_size; ++i)
+    rs_tab[i].name = -1;
+  for (i = 0; i < old_size; ++i)
+    if (old[i].name != -1)
+      {
+        j = old[i].hash & (rs_size - 1);
+        while (rs_tab[j].name != -1)
+          j = (j + 1) & (rs_size - 1);
+        rs_tab[j] = old[i];
+      }
+  free (old);
+}
+
+
+/* Enter the import of the symbol FUNC from the DLL MODULE into the
+   resolver table.  The entry point is PROC, or ORDINAL if PROC is
+   NULL.  As when linking, the first input file defining a symbol
+   wins. */
+
+static void resolve_add (const char *func, const char *module, int ordinal,
+                         const char *proc)
+{
+  struct rs_entry *e;
+  dword h;
+
+  if (2 * (rs_count + 1) > rs_size)
+    rs_grow ();
+  h = block_hash ((const unsigned char *)func, strlen (func),
+                  2166136261U, 16777619);
+  e = rs_lookup (func, h);
+  if (e->name != -1)
+    return;
+  e->hash = h;
+  e->name = rs_add_str (func);
+
+  /* The imports of a file usually come from one DLL. */
+
+  if (rs_last_module == -1 || strcmp (rs_str + rs_last_module, module) != 0)
+    rs_last_module = rs_add_str (module);
+  e->module = rs_last_module;
+  e->proc = (proc != NULL ? rs_add_str (proc) : -1);
+  e->ordinal = ordinal;
+  e->fname = rs_fname;
+  ++rs_count;
+}
+
+
+/* Print the input file, the DLL and the entry point defining the
+   symbol NAME.  Unresolved symbols count as warnings. */
+
+static void resolve (const char *name)
+{
+  const struct rs_entry *e;
+
+  e = NULL;
+  if (rs_size != 0)
+    {
+      e = rs_lookup (name, block_hash ((const unsigned char *)name,
+                                       strlen (name), 2166136261U, 16777619));
+      if (e->name == -1)
+        e = NULL;
+    }
+  if (e == NULL)
+    {
+      printf ("%s -\n", name);
+      ++warnings;
+    }
+  else if (e->proc == -1)
+    printf ("%s %s %s @%d\n", name, e->fname, rs_str + e->module,
+            e->ordinal);
+  else
+    printf ("%s %s %s %s\n", name, e->fname, rs_str + e->module,
+            rs_str + e->proc);
+}
+
+
+/* Look up the symbols given by the -r options.  For -r -, read symbol
+   names from the standard input, one per line. */
+
+static void resolve_queries (void)
+{
+  char buf[512], *p, *q;
+  int i;
+
+  for (i = 0; i < query_count; ++i)
+    if (strcmp (queries[i], "-") != 0)
+      resolve (queries[i]);
+    else
+      {
+        while (fgets (buf, sizeof (buf), stdin) != NULL)
+          {
+            p = buf;
+            while (isspace ((unsigned char)*p)) ++p;
+            q = p;
+            while (*q != 0 && !isspace ((unsigned char)*q)) ++q;
+            *q = 0;
+            if (*p != 0)
+              resolve (p);
+          }
+        if (ferror (stdin))
+          error ("Read error on standard input");
+      }
+  if (fflush (stdout) != 0 || ferror (stdout))
+    error ("Write error on standard output");
+}
+
+
+static void read_input (const char *fname)
+{
+  const char *ext;
+
+  switch (mode)
+    {
+    case M_LIB_TO_IMP:
+    case M_LIB_TO_A:
+      read_lib (fname);
+      break;
+    case M_DEF_TO_IMP:
+    case M_DEF_TO_A:
+    case M_DEF_TO_LIB:
+      read_def (fname);
+      break;
+    case M_RESOLVE:
+      rs_fname = fname;
+      ext = _getext (fname);
+      if (stricmp (ext, ".lib") == 0)
+        read_lib (fname);
+      else if (stricmp (ext, ".def") == 0)
+        read_def (fname);
+      else
+        read_imp (fname);
+      break;
+    default:
+      read_imp (fname);
+      break;
+    }
+}
+
+
+#if defined (USE_THREADS)
+
+/* Convert one input file in a worker.  Output goes to a temporary
+   file, imports for import libraries are collected in JOB.  If
+   error() is called, JOB is marked as failed. */
+
+static void run_job (struct job *job)
+{
+  if (setjmp (job->fail) != 0)
+    {
+      job->failed = TRUE;
+      cur_job = NULL;
+      return;
+    }
+  cur_job = job;
+  seq_no = 1; warnings = 0;
+  job->out = NULL;
+  if (mode != M_IMP_TO_LIB && mode != M_DEF_TO_LIB && mode != M_LIB_TO_A
+      && mode != M_IMP_TO_A && mode != M_DEF_TO_A)
+    {
+      job->out = tmpfile ();
+      if (job->out == NULL)
+        error ("Cannot create temporary file");
+    }
+  out_file = job->out;
+  read_input (job->fname);
+  if (job->out != NULL && fflush (job->out) != 0)
+    error ("Write error on temporary file");
+  job->arena = ar_arena; job->arena_len = ar_arena_len;
+  ar_arena = NULL; ar_arena_len = 0; ar_arena_size = 0;
+  job->syms = ar_sym_tab; job->sym_count = ar_sym_count;
+  job->sym_str = ar_sym_str;
+  ar_sym_tab = NULL; ar_sym_count = 0; ar_sym_alloc = 0;
+  ar_sym_str = NULL; ar_sym_str_len = 0; ar_sym_str_size = 0;
+  job->warnings = warnings;
+  cur_job = NULL;
+}
+
+
+/* Copy the rest of the temporary file F to the output file. */
+
+static void copy_out (FILE *f)
+{
+  char buf[0x8000];
+  size_t len;
+
+  while ((len = fread (buf, 1, sizeof (buf), f)) != 0)
+    if (fwrite (buf, 1, len, out_file) != len)
+      write_error (out_fname);
+  if (ferror (f))
+    error ("Read error on temporary file");
+}
+
+/* Append the output of JOB to the output file.  The a.out archive
+   members are renumbered as they would have been numbered by
+   converting the input files one after the other.  The diagnostics
+   of JOB are printed first; if JOB failed, terminate the program. */
+
+static void splice_job (struct job *job)
+{
+  struct import *ip1, *ip2;
+  long i, base;
+  char buf[512];
+  size_t len;
+
+  if (job->diag != NULL)
+    {
+      rewind (job->diag);
+      while ((len = fread (buf, 1, sizeof (buf), job->diag)) != 0)
+        fwrite (buf, 1, len, stderr);
+      fclose (job->diag);
+      job->diag = NULL;
+    }
+  if (job->failed)
+    exit (2);
+  warnings += job->warnings;
+  if (job->out != NULL)
+    {
+      if (fseek (job->out, 0L, SEEK_SET) != 0)
+        error ("Read error on temporary file");
+      copy_out (job->out);
+      fclose (job->out);
+      job->out = NULL;
+    }
+  if (job->arena != NULL)
+    {
+      for (i = 0; i < job->member_count; ++i)
+        set_ar_import ((struct ar_hdr *)(job->arena + job->members[i]),
+                       seq_no++);
+      base = ar_arena_len;
+      memcpy (ar_reserve (job->arena_len), job->arena, job->arena_len);
+      for (i = 0; i < job->sym_count; ++i)
+        ar_add_sym (job->sym_str + job->syms[i].name,
+                    base + job->syms[i].member);
+      free (job->arena); free (job->syms); free (job->sym_str);
+      job->arena = NULL;
+    }
+  free (job->members);
+  job->members = NULL;
+  for (ip1 = job->imports; ip1 != NULL; ip1 = ip2)
+    {
+      ip2 = ip1->next;
+      write_lib_import (ip1->func, ip1->module, ip1->ord, ip1->name);
+      free (ip1->func); free (ip1->module); free (ip1->name);
+      free (ip1);
+    }
+  job->imports = NULL;
+}
+
+
+static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static struct job *job_tab;
+static int job_count;
+static int job_next;
+
+static void *worker (void *arg)
+{
+  struct job *job;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&job_mutex);
+      if (job_next >= job_count)
+        {
+          pthread_mutex_unlock (&job_mutex);
+          return NULL;
+        }
+      job = &job_tab[job_next++];
+      pthread_mutex_unlock (&job_mutex);
+      run_job (job);
+      pthread_mutex_lock (&job_mutex);
+
+      /* The output of the jobs after a failed one won't be used, as
+         splice_job() terminates the program; don't start them. */
+
+      if (job->failed && job_count > job - job_tab + 1)
+        job_count = job - job_tab + 1;
+      job->done = TRUE;
+      pthread_cond_broadcast (&job_cond);
+      pthread_mutex_unlock (&job_mutex);
+    }
+}
+
+#endif
+
+
+/* Convert the N input files of NAMES.  Use up to `jobs' worker
+   threads; the output is the same as for converting the files one
+   after the other. */
+
+static void read_inputs (int n, char **names)
+{
+  int i;
+#if defined (USE_THREADS)
+  pthread_t *threads;
+  int thread_count;
+#endif
+
+  if (jobs <= 1 || n <= 1 || mode == M_IMP_TO_S || mode == M_IMP_TO_DEF
+      || mode == M_RESOLVE)
+    {
+      for (i = 0; i < n; ++i)
+        read_input (names[i]);
+      return;
+    }
+#if defined (USE_THREADS)
+  job_tab = xmalloc (n * sizeof (*job_tab));
+  for (i = 0; i < n; ++i)
+    {
+      job_tab[i].fname = names[i];
+      job_tab[i].index = i;
+      job_tab[i].out = NULL;
+      job_tab[i].arena = NULL;
+      job_tab[i].arena_len = 0;
+      job_tab[i].syms = NULL;
+      job_tab[i].sym_count = 0;
+      job_tab[i].sym_str = NULL;
+      job_tab[i].members = NULL;
+      job_tab[i].member_count = 0;
+      job_tab[i].member_alloc = 0;
+      job_tab[i].imports = NULL;
+      job_tab[i].imports_add = &job_tab[i].imports;
+      job_tab[i].diag = NULL;
+      job_tab[i].failed = FALSE;
+      job_tab[i].warnings = 0;
+      job_tab[i].done = FALSE;
+    }
+  job_count = n; job_next = 0;
+  thread_count = (jobs < n ? jobs : n);
+  threads = xmalloc (thread_count * sizeof (*threads));
+  for (i = 0; i < thread_count; ++i)
+    if (pthread_create (&threads[i], NULL, worker, NULL) != 0)
+      error ("Cannot create thread");
+  for (i = 0; i < n; ++i)
+    {
+      pthread_mutex_lock (&job_mutex);
+      while (!job_tab[i].done)
+        pthread_cond_wait (&job_cond, &job_mutex);
+      pthread_mutex_unlock (&job_mutex);
+      splice_job (&job_tab[i]);
+    }
+  for (i = 0; i < thread_count; ++i)
+    pthread_join (threads[i], NULL);
+  free (threads);
+  free (job_tab);
+#else
+  for (i = 0; i < n; ++i)
+    read_input (names[i]);
+#endif
+}
+
+
+/* Print statistics about the dictionary of the output library. */
+
+static void dict_stats (void)
+{
+  struct omflib_dict_stats st;
+  long bytes;
+  int i, allocs, bin;
+
+  if (omflib_dict_stats (out_lib, &st, lib_errmsg) != 0)
+    lib_error ();
+  allocs = omflib_alloc_count (out_lib, &bytes);
+  bin = 512 / OMFLIB_FILL_BINS;
+  printf ("Dictionary of %s:\n", out_fname);
+  printf ("  Blocks:        %d (%d full), size increased %d times\n",
+          st.blocks, st.full_blocks, st.retries);
+  printf ("  Entries:       %d\n", st.symbols);
+  printf ("  Probes:        %.2f average, %d maximum\n",
+          (st.symbols != 0 ? (double)st.probe_sum / st.symbols : 0.0),
+          st.probe_max);
+  printf ("  Unused bytes:  %ld of %ld (%.1f%%)\n",
+          st.wasted_bytes, 512L * st.blocks,
+          (st.blocks != 0 ? 100.0 * st.wasted_bytes / (512.0 * st.blocks)
+           : 0.0));
+  printf ("  Block fill:\n");
+  for (i = 0; i < OMFLIB_FILL_BINS; ++i)
+    printf ("    %3d-%3d bytes: %d\n", i * bin + 1, (i + 1) * bin,
+            st.fill_hist[i]);
+  printf ("  Allocations:   %d (%ld bytes)\n", allocs, bytes);
+  if (fflush (stdout) != 0 || ferror (stdout))
+    error ("Write error on standard output");
+}
+
+
+static void finish_lib (void)
+{
+  if (omflib_finish (out_lib, lib_errmsg) != 0
+      || (opt_x && omflib_write_index (out_lib, idx_fname, lib_errmsg) != 0))
+    lib_error ();
+  if (dict_stats_flag)
+    dict_stats ();
+  if (omflib_close (out_lib, lib_errmsg) != 0)
+    lib_error ();
 }
 
 
 int main (int argc, char *argv[])
 {
-  int i, c;
-  int imp_count, lib_count, def_count, page_size;
+  int i, j, c;
+  int imp_count, lib_count, def_count, page_size, auto_page;
   struct predef *pp1;
   char *q, *ext, *opt_o;
 char optswchar;
   
   _response (&argc, &argv);
+
+  /* getopt() doesn't know long options, remove --dict-stats. */
+
+  dict_stats_flag = FALSE;
+  for (i = j = 1; i < argc; ++i)
+    if (strcmp (argv[i], "--dict-stats") == 0)
+      dict_stats_flag = TRUE;
+    else
+      argv[j++] = argv[i];
+  argc = j; argv[argc] = NULL;
   predefs = NULL; out_base = NULL; as_name = NULL; pipe_flag = FALSE;
+  obj_flag = FALSE;
   profile_flag = FALSE; page_size = 16;
-  opt_b = FALSE; opt_q = FALSE; opt_s = FALSE; base_len = 0; opt_o = NULL;
+  opt_b = FALSE; opt_c = FALSE; opt_q = FALSE; opt_s = FALSE; base_len = 0; opt_o = NULL;
+  opt_x = FALSE;
   opterr = 0;
   optswchar = "-";
   optind = 0;
-  while ((c = getopt (argc, argv, "a::b:mo:p:qsP:")) != EOF)
+  while ((c = getopt (argc, argv, "a::b:cj:k:mo:p:qr:sxP:")) != EOF)
     {
       switch (c)
         {
         case 'a':
-          as_name = (optarg != NULL ? optarg : "as");
+          as_name = optarg;
+          obj_flag = (optarg == NULL);
          // pipe_flag = (_osmode != DOS_MODE);
           break;
         case 'b':
@@ -1071,6 +2618,17 @@ char optswchar;
               base_len = 0;
             }
           break;
+        case 'c':
+          opt_c = TRUE;
+          break;
+        case 'j':
+          jobs = strtol (optarg, &q, 10);
+          if (jobs < 1 || *q != 0)
+            usage ();
+          break;
+        case 'k':
+          cache_dir = optarg;
+          break;
         case 'm':
           profile_flag = TRUE;
           break;
@@ -1088,9 +2646,16 @@ char optswchar;
         case 'q':
           opt_q = TRUE;
           break;
+        case 'r':
+          queries = xrealloc (queries, (query_count + 1) * sizeof (*queries));
+          queries[query_count++] = optarg;
+          break;
         case 's':
           opt_s = TRUE;
           break;
+        case 'x':
+          opt_x = TRUE;
+          break;
         default:
           error ("Invalid option");
         }
@@ -1110,16 +2675,22 @@ char optswchar;
     }
   if (imp_count == 0 && lib_count == 0 && def_count == 0)
     usage ();
-  if ((imp_count != 0) + (lib_count != 0) + (def_count != 0) > 1)
+  if (query_count != 0)
+    {
+      if (opt_o != NULL)
+        usage ();
+      mode = M_RESOLVE;
+    }
+  else if ((imp_count != 0) + (lib_count != 0) + (def_count != 0) > 1)
     error ("More than one type of input files");
-  if (opt_o == NULL)
+  else if (opt_o == NULL)
     {
       if (lib_count != 0)
         error ("Cannot convert .lib files to %s files",
-               (as_name == NULL ? ".s" : ".o"));
+               (as_name == NULL && !obj_flag ? ".s" : ".o"));
       if (def_count != 0)
         error ("Cannot convert .def files to %s files",
-               (as_name == NULL ? ".s" : ".o"));
+               (as_name == NULL && !obj_flag ? ".s" : ".o"));
       mode = M_IMP_TO_S;
     }
   else
@@ -1163,19 +2734,41 @@ char optswchar;
             {
               if (predefs->next != NULL)
                 usage ();
-              page_size = strtol (predefs->name, &q, 10);
-              if (page_size < 1 || *q != 0)
-                usage ();
+              if (strcmp (predefs->name, "auto") == 0)
+                page_size = 0;
+              else
+                {
+                  page_size = strtol (predefs->name, &q, 10);
+                  if (page_size < 1 || *q != 0)
+                    usage ();
+                }
               predefs = NULL;   /* See below */
             }
+          if (opt_x)
+            {
+              idx_fname = xmalloc (strlen (opt_o) + 5);
+              strcpy (idx_fname, opt_o);
+              q = _getext (idx_fname);
+              if (q == NULL)
+                q = strchr (idx_fname, 0);
+              strcpy (q, ".ndx");
+            }
         }
       else
         error ("File name extension of output file not supported");
-      _strncpy (out_fname, opt_o, sizeof (out_fname));
+      if (strlen (opt_o) >= sizeof (out_fname))
+        error ("Output file name too long");
+      strcpy (out_fname, opt_o);
     }
   if (mode != M_IMP_TO_S)
-    if (as_name != NULL || opt_b || opt_s || predefs != NULL)
+    if (as_name != NULL || obj_flag || opt_b || opt_s || predefs != NULL)
       usage ();
+  if (opt_c && mode != M_LIB_TO_IMP && mode != M_LIB_TO_A
+      && mode != M_RESOLVE)
+    usage ();
+  if ((opt_x || dict_stats_flag)
+      && mode != M_IMP_TO_LIB && mode != M_DEF_TO_LIB)
+    usage ();
   if (profile_flag && mode != M_DEF_TO_A && mode != M_IMP_TO_A
       && mode != M_LIB_TO_A)
     usage ();
@@ -1183,70 +2776,69 @@ char optswchar;
     {
     case M_LIB_TO_IMP:
       create_output_file (FALSE);
-      for (i = optind; i < argc; ++i)
-        read_lib (argv[i]);
+      read_inputs (argc - optind, argv + optind);
       close_output_file ();
       break;
     case M_LIB_TO_A:
       create_output_file (TRUE);
       init_archive ();
-      for (i = optind; i < argc; ++i)
-        read_lib (argv[i]);
+      read_inputs (argc - optind, argv + optind);
+      finish_archive ();
       close_output_file ();
       break;
     case M_IMP_TO_S:
-      for (i = optind; i < argc; ++i)
-        read_imp (argv[i]);
+      hash_predefs ();
+      read_inputs (argc - optind, argv + optind);
       break;
     case M_IMP_TO_DEF:
       create_output_file (FALSE);
-      for (i = optind; i < argc; ++i)
-        read_imp (argv[i]);
+      read_inputs (argc - optind, argv + optind);
       close_output_file ();
       break;
-    case M_IMP_TO_LIB:
-      out_lib = omflib_create (out_fname, page_size, lib_errmsg);
-      if (out_lib == NULL)
-        lib_error ();
-      if (omflib_header (out_lib, lib_errmsg) != 0)
-        lib_error ();
-      for (i = optind; i < argc; ++i)
-        read_imp (argv[i]);
-      if (omflib_finish (out_lib, lib_errmsg) != 0
-          || omflib_close (out_lib, lib_errmsg) != 0)
-        lib_error ();
-      break;
     case M_IMP_TO_A:
       create_output_file (TRUE);
       init_archive ();
-      for (i = optind; i < argc; ++i)
-        read_imp (argv[i]);
+      read_inputs (argc - optind, argv + optind);
+      finish_archive ();
       close_output_file ();
       break;
     case M_DEF_TO_A:
       create_output_file (TRUE);
       init_archive ();
-      for (i = optind; i < argc; ++i)
-        read_def (argv[i]);
+      read_inputs (argc - optind, argv + optind);
+      finish_archive ();
       close_output_file ();
       break;
     case M_DEF_TO_IMP:
       create_output_file (FALSE);
-      for (i = optind; i < argc; ++i)
-        read_def (argv[i]);
+      read_inputs (argc - optind, argv + optind);
       close_output_file ();
       break;
+    case M_IMP_TO_LIB:
     case M_DEF_TO_LIB:
+      /* For -p auto, the imports are collected first to choose the
+         page size. */
+
+      auto_page = (page_size == 0);
+      if (auto_page)
+        {
+          read_inputs (argc - optind, argv + optind);
+          page_size = auto_page_size ();
+        }
       out_lib = omflib_create (out_fname, page_size, lib_errmsg);
       if (out_lib == NULL)
         lib_error ();
       if (omflib_header (out_lib, lib_errmsg) != 0)
         lib_error ();
-      for (i = optind; i < argc; ++i)
-        read_def (argv[i]);
-      if (omflib_finish (out_lib, lib_errmsg) != 0
-          || omflib_close (out_lib, lib_errmsg) != 0)
-        lib_error ();
+      if (auto_page)
+        write_lib_imports ();
+      else
+        read_inputs (argc - optind, argv + optind);
+      finish_lib ();
+      break;
+    case M_RESOLVE:
+      read_inputs (argc - optind, argv + optind);
+      resolve_queries ();
       break;
     default:
       usage ();
@@ -0,0 +1,100 @@
+/* mdbench.c (emx+gcc) */
+
+/* Measure the speed of the lexer of the moddef library.
+
+   Usage: mdbench [<input_file>.def]
+
+   Without argument, a .def file with 100000 exports is generated in a
+   temporary file.  The file is split into tokens by _md_next_token()
+   several times and the number of tokens per second is printed. */
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/moddef.h>
+
+#define EXPORTS 100000
+#define RUNS    20
+
+
+/* Write a .def file with N exports to F. */
+
+static void make_def (FILE *f, long n)
+{
+  long i;
+
+  fputs ("LIBRARY BENCH INITINSTANCE TERMINSTANCE\n"
+         "DESCRIPTION 'moddef lexer benchmark'\n"
+         "DATA MULTIPLE NONSHARED\n"
+         "EXPORTS\n", f);
+  for (i = 0; i < n; ++i)
+    switch (i % 4)
+      {
+      case 0:
+        fprintf (f, "  Function%ld @%ld\n", i, i + 1);
+        break;
+      case 1:
+        fprintf (f, "  \"_Entry%ld\" = Internal%ld @%ld RESIDENTNAME\n",
+                 i, i, i + 1);
+        break;
+      case 2:
+        fprintf (f, "  Data%ld @%ld NONAME ; data\n", i, i + 1);
+        break;
+      default:
+        fprintf (f, "  Call16_%ld @%ld 2 NODATA\n", i, i + 1);
+        break;
+      }
+}
+
+
+int main (int argc, char *argv[])
+{
+  struct _md *md;
+  _md_token token;
+  FILE *f;
+  long tokens;
+  clock_t start;
+  double secs;
+  int i;
+
+  if (argc > 2)
+    {
+      fputs ("Usage: mdbench [<input_file>.def]\n", stderr);
+      return 1;
+    }
+  if (argc == 2)
+    f = fopen (argv[1], "r");
+  else
+    {
+      f = tmpfile ();
+      if (f != NULL)
+        make_def (f, EXPORTS);
+    }
+  if (f == NULL || fflush (f) != 0)
+    {
+      perror ("mdbench");
+      return 2;
+    }
+  tokens = 0;
+  start = clock ();
+  for (i = 0; i < RUNS; ++i)
+    {
+      rewind (f);
+      md = _md_use_file (f);
+      if (md == NULL)
+        {
+          fputs ("mdbench: Out of memory\n", stderr);
+          return 2;
+        }
+      while ((token = _md_next_token (md)) != _MD_eof
+             && token != _MD_ioerror && token != _MD_missingquote)
+        ++tokens;
+      _md_close (md);
+    }
+  secs = (double)(clock () - start) / CLOCKS_PER_SEC;
+  printf ("%ld tokens in %.3f seconds", tokens, secs);
+  if (secs > 0)
+    printf (", %.0f tokens per second", tokens / secs);
+  putchar ('\n');
+  fclose (f);
+  return 0;
+}
@@ -0,0 +1,39 @@
+/* moddef0.h (emx+gcc) */
+
+/* Private header file for the emx MODDEF library. */
+
+#if defined (__unix__) || defined (__APPLE__)
+#include <unistd.h>
+#endif
+
+#if defined (_POSIX_THREADS) && _POSIX_THREADS > 0
+#define USE_THREADS
+#endif
+
+#define MDF_ALLOC   0x0001      /* md->buffer has been allocated */
+#define MDF_IOERROR 0x0002      /* Error while reading the file */
+#define MDF_STRING  0x0004      /* md->string holds the current token */
+
+/* The lexer works on the complete text of the module definition file,
+   which is either supplied by the caller (_md_use_buffer()) or read
+   into memory (_md_use_file(), _md_open()).  A token is described by
+   pointer and length into the text; it is copied to md->string only
+   on demand. */
+
+struct _md
+{
+  _md_token token;
+  long number;
+  long linenumber;
+  unsigned flags;
+  int threads;                  /* Threads for parsing EXPORTS */
+  const char *buffer;           /* Start of the text */
+  const char *end;              /* End of the text */
+  const char *ptr;              /* Current position */
+  const char *start;            /* Start of the current token */
+  const char *text;             /* Text of the current token */
+  size_t len;                   /* Length of the current token */
+  char string[512];
+};
+
+void _md_set_position (struct _md *md, const char *p, long linenumber);
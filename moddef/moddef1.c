@@ -7,23 +7,10 @@
 #include <share.h>
 #include <errno.h>
 #include <sys/moddef.h>
+#include "moddef0.h"
 
 #define ERRNO (*_errno ())
 
-#define MDF_OPEN 0x0001
-
-struct _md
-{
-  _md_token token;
-  FILE *file;
-  long number;
-  long linenumber;
-  unsigned flags;
-  const char *ptr;
-  char string[512];
-  char buffer[512];
-};
-
 /* An entry of the keywords table associates a keyword string with a
    token index. */
 
@@ -120,6 +107,58 @@ static struct keyword keywords[] =
   {NULL,              _MD_word}
 };
 
+/* Keywords are looked up by a hash code computed from the length, the
+   first two and the last character of the word, ignoring letter case.
+   This hash function is collision-free for keywords[]. */
+
+#define KW_MIN_LEN 3
+#define KW_MAX_LEN 15
+
+#define KW_HASH(s,n) ((7 * toupper ((unsigned char)(s)[0])          \
+                       + toupper ((unsigned char)(s)[1])            \
+                       + 14 * toupper ((unsigned char)(s)[(n)-1])   \
+                       + 5 * (n)) & 511)
+
+/* keyword_hash[KW_HASH (name, len)] is one plus the index of the
+   keyword in keywords[], or 0.  This table has been generated from
+   keywords[] and must be regenerated when adding a keyword. */
+
+static const unsigned char keyword_hash[512] =
+{
+   0,  0, 13,  0, 20, 10,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 40,  0,  0,
+   0,  0, 11,  0, 17,  0,  0, 22, 28,  0, 16, 21,  0,  0,  0,  0,
+  24,  0,  0,  0,  0,  0, 25,  0,  5,  0,  0,  0, 51, 38,  0,  0,
+   0,  0,  0,  0,  0,  0,  0,  0,  0, 71,  0, 46,  0,  0,  0, 27,
+  58,  0,  0, 35,  0, 43, 48,  0, 36,  0,  0,  0,  0, 56, 37, 61,
+   0,  0,  0, 68,  0,  0,  0,  0,  0,  0,  0, 57,  0,  0,  0,  0,
+  60, 64, 69,  0,  0,  0, 63,  0,  0,  0,  0,  0,  0, 45,  0,  0,
+   0,  0,  0,  0,  0, 66,  0,  0,  0,  0, 29,  0, 70,  0,  0, 72,
+   0,  0,  0, 74, 44,  0,  0,  0,  0,  0,  0,  0,  8,  0,  0,  0,
+   0,  0, 33,  0,  0,  0,  0, 26,  0,  0,  0,  0,  0,  0,  0,  0,
+   0, 18,  0,  0,  0,  0,  1, 42,  0,  0,  0,  0,  0, 31,  0,  0,
+   0,  0,  0,  0,  3,  0,  0,  0, 55,  0,  0,  0,  0,  0,  0,  0,
+   0,  0,  0,  0,  0, 77,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+   6,  0,  0,  0,  0,  0,  0,  0, 19,  0,  0, 73,  0,  0, 76,  0,
+   0, 41,  0,  0,  0,  0,  0,  0,  0, 23,  0,  0,  0,  0,  0,  0,
+   0,  0,  0,  0,  0,  0,  0,  0, 75,  0,  0,  0,  0,  0,  0,  0,
+  52,  0,  0,  0,  0,  0,  0, 12, 50, 39, 32,  0,  0,  0,  0,  0,
+   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+   0,  0,  0,  9,  0,  0,  0,  0,  0,  0, 54,  0, 67, 59,  0,  0,
+   0,  0,  0, 65,  0, 47,  0, 53,  0,  0,  0,  0,  0, 34,  0,  0,
+  14,  0,  0,  0, 49, 15,  0, 79,  0,  0,  0,  0,  0,  0, 30,  0,
+   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 78,  0,
+   0,  0,  0,  0,  0,  0,  0,  0,  0, 62,  0,  0,  0,  0,  0,  0,
+   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  7,
+   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+   0,  0,  0,  0,  0,  0,  0,  0,  0,  2,  0,  0,  0,  0,  0,  0,
+   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  4,  0
+};
+
 
 _md_token _md_get_token (const struct _md *md)
 {
@@ -133,127 +172,163 @@ long _md_get_number (const struct _md *md)
 }
 
 
+/* Return the current token as null-terminated string.  The string is
+   truncated to 511 characters. */
+
 const char *_md_get_string (const struct _md *md)
 {
+  struct _md *p;
+  size_t len;
+
+  if (!(md->flags & MDF_STRING))
+    {
+      /* Fill in the cache: struct _md is never a const object. */
+
+      p = (struct _md *)md;
+      len = md->len;
+      if (len > sizeof (p->string) - 1)
+        len = sizeof (p->string) - 1;
+      memcpy (p->string, md->text, len);
+      p->string[len] = 0;
+      p->flags |= MDF_STRING;
+    }
   return md->string;
 }
 
 
+/* Return a pointer to the text of the current token, which is not
+   null-terminated, and store its length to *LEN. */
+
+const char *_md_get_text (const struct _md *md, size_t *len)
+{
+  *len = md->len;
+  return md->text;
+}
+
+
 long _md_get_linenumber (const struct _md *md)
 {
   return md->linenumber;
 }
 
 
-/* Read a line from the module definition file to md->buffer.  Set
-   md->token and return -1 on error or if the end of the file is
-   reached.  Otherwise, return 0, increment the line number and move
-   md->ptr to the start of the line. */
+/* Return the token of the keyword S of length LEN, or _MD_word if S
+   is not a keyword. */
 
-static int get_line (struct _md *md)
+static _md_token find_keyword (const char *s, size_t len)
 {
-  char *p;
-  
-  if (fgets (md->buffer, sizeof (md->buffer), md->file) == NULL)
-    {
-      md->token = (ferror (md->file) ? _MD_ioerror : _MD_eof);
-      return -1;
-    }
-  p = strchr (md->buffer, '\n');
-  if (p != NULL) *p = 0;
-  md->ptr = md->buffer;
-  ++md->linenumber;
-  return 0;
+  int i;
+
+  if (len < KW_MIN_LEN || len > KW_MAX_LEN)
+    return _MD_word;
+  i = keyword_hash[KW_HASH (s, len)];
+  if (i != 0 && memicmp (s, keywords[i-1].name, len) == 0
+      && keywords[i-1].name[len] == 0)
+    return keywords[i-1].token;
+  return _MD_word;
 }
 
 
+/* Characters which end a word. */
+
+#define WORD_END(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n' \
+                     || (c) == '=' || (c) == '@' || (c) == '.' || (c) == 0)
+
+
 _md_token _md_next_token (struct _md *md)
 {
-  const char *start, *end;
-  char *p, quote_char;
+  const char *p, *end;
+  char tmp[64], *q, quote_char;
   long n;
-  int i;
 
   md->number = 0;
-  md->string[0] = 0;
+  md->flags &= ~MDF_STRING;
+  p = md->ptr; end = md->end;
   for (;;)
     {
-      if (*md->ptr == ' ' || *md->ptr == '\t')
-        ++md->ptr;
-      else if (*md->ptr == 0 || *md->ptr == ';')
+      if (p == end)
         {
-          if (get_line (md) != 0)
-            return md->token;
+          md->ptr = p; md->start = p; md->text = p; md->len = 0;
+          md->token = (md->flags & MDF_IOERROR ? _MD_ioerror : _MD_eof);
+          return md->token;
+        }
+      if (*p == ' ' || *p == '\t' || *p == '\r' || *p == 0)
+        ++p;
+      else if (*p == '\n')
+        {
+          /* Count the line when its first character is reached, as
+             the last line need not end with a newline character. */
+
+          if (++p != end)
+            ++md->linenumber;
+        }
+      else if (*p == ';')
+        {
+          while (p != end && *p != '\n')
+            ++p;
         }
       else
         break;
     }
-  if (*md->ptr == '\'' || *md->ptr == '\"')
+  md->start = p;
+  if (*p == '\'' || *p == '\"')
     {
-      quote_char = *md->ptr;
+      quote_char = *p++;
       md->token = _MD_quote;
-      start = ++md->ptr;
-      while (*md->ptr != 0 &&
-             (*md->ptr != quote_char || md->ptr[1] == quote_char))
-        ++md->ptr;
-      if (*md->ptr != quote_char)
+      md->text = p;
+      while (p != end && *p != '\n'
+             && (*p != quote_char || (p + 1 != end && p[1] == quote_char)))
+        ++p;
+      if (p == end || *p != quote_char)
         {
+          md->ptr = p; md->len = 0;
           md->token = _MD_missingquote;
           return md->token;
         }
-      end = md->ptr++;
+      md->len = p++ - md->text;
     }
-  else if (*md->ptr == '=')
+  else if (*p == '=' || *p == '@' || *p == '.')
     {
-      md->token = _MD_equal;
-      start = md->ptr++; end = md->ptr;
-    }
-  else if (*md->ptr == '@')
-    {
-      md->token = _MD_at;
-      start = md->ptr++; end = md->ptr;
-    }
-  else if (*md->ptr == '.')
-    {
-      md->token = _MD_dot;
-      start = md->ptr++; end = md->ptr;
+      md->token = (*p == '=' ? _MD_equal : *p == '@' ? _MD_at : _MD_dot);
+      md->text = p++; md->len = 1;
     }
   else
     {
-      md->token = _MD_word;
-      start = md->ptr++;
-      md->ptr += strcspn (md->ptr, " \t=@.");
-      end = md->ptr;
-    }
-  _strncpy (md->string, start, end+1-start);
-  if (md->token == _MD_word)
-    for (i = 0; keywords[i].name != NULL; ++i)
-      if (stricmp (md->string, keywords[i].name) == 0)
-        {
-          md->token = keywords[i].token;
-          break;
-        }
-  if (md->token == _MD_word)
-    {
-      if (isdigit ((unsigned char)md->string[0]))
+      md->text = p++;
+      while (p != end && !WORD_END (*p))
+        ++p;
+      md->len = p - md->text;
+      md->token = find_keyword (md->text, md->len);
+      if (md->token == _MD_word && isdigit ((unsigned char)*md->text)
+          && md->len < sizeof (tmp))
         {
+          memcpy (tmp, md->text, md->len);
+          tmp[md->len] = 0;
           ERRNO = 0;
-          n = strtol (md->string, &p, 0);
-          if (p != md->string && *p == 0 && ERRNO == 0)
+          n = strtol (tmp, &q, 0);
+          if (q != tmp && *q == 0 && ERRNO == 0)
             {
               md->token = _MD_number;
               md->number = n;
             }
         }
     }
+  md->ptr = p;
   return md->token;
 }
 
 
-struct _md *_md_use_file (FILE *f)
+/* Use the SIZE bytes of text at BUF, which must not be changed or
+   freed before calling _md_close().  As the text is not read in text
+   mode, a DOS end-of-file character (Ctrl-Z) at the end is ignored
+   here. */
+
+struct _md *_md_use_buffer (const char *buf, size_t size)
 {
   struct _md *p;
 
+  if (size != 0 && buf[size-1] == 0x1a)
+    --size;
   p = malloc (sizeof (*p));
   if (p == NULL)
     {
@@ -262,12 +337,62 @@ struct _md *_md_use_file (FILE *f)
     }
   p->token = _MD_eof;
   p->string[0] = 0;
-  p->buffer[0] = 0;
-  p->ptr = p->buffer;
+  p->buffer = buf;
+  p->end = buf + size;
+  p->ptr = buf;
+  p->start = buf;
+  p->text = buf;
+  p->len = 0;
   p->number = 0;
-  p->linenumber = 0;
-  p->file = f;
-  p->flags = 0;
+  p->linenumber = (size != 0 ? 1 : 0);
+  p->flags = MDF_STRING;
+  p->threads = 1;
+  return p;
+}
+
+
+/* Read the rest of the file F into memory. */
+
+struct _md *_md_use_file (FILE *f)
+{
+  struct _md *p;
+  char *buf, *tmp;
+  size_t size, alloc, n;
+  int ioerror;
+
+  size = 0; alloc = 0x4000; ioerror = 0;
+  buf = malloc (alloc);
+  if (buf == NULL)
+    {
+      ERRNO = ENOMEM;
+      return NULL;
+    }
+  while ((n = fread (buf + size, 1, alloc - size, f)) != 0)
+    {
+      size += n;
+      if (size == alloc)
+        {
+          tmp = realloc (buf, 2 * alloc);
+          if (tmp == NULL)
+            {
+              free (buf);
+              ERRNO = ENOMEM;
+              return NULL;
+            }
+          buf = tmp; alloc *= 2;
+        }
+    }
+  if (ferror (f))
+    ioerror = 1;
+  p = _md_use_buffer (buf, size);
+  if (p == NULL)
+    free (buf);
+  else
+    {
+      p->flags |= MDF_ALLOC;
+      if (ioerror)
+        p->flags |= MDF_IOERROR;
+    }
   return p;
 }
 
@@ -277,24 +402,38 @@ struct _md *_md_open (const char *fname)
   FILE *f;
   struct _md *p;
 
-  f = _fsopen (fname, "rt", SH_DENYWR);
+  f = _fsopen (fname, "rb", SH_DENYWR);
   if (f == NULL)
     return NULL;
   p = _md_use_file (f);
-  if (p == NULL)
-    fclose (f);
-  else
-    p->flags |= MDF_OPEN;
+  fclose (f);
   return p;
 }
 
 
-int _md_close (struct _md *md)
+/* Let _md_parse_batch() use up to N threads for parsing long EXPORTS
+   statements. */
+
+void _md_set_threads (struct _md *md, int n)
 {
-  int result = 0;
+  md->threads = (n < 1 ? 1 : n);
+}
+
+
+/* Continue lexing at P, which is in line LINENUMBER of the text.  P
+   must not be inside a token. */
+
+void _md_set_position (struct _md *md, const char *p, long linenumber)
+{
+  md->ptr = p;
+  md->linenumber = linenumber;
+}
+
 
-  if (md->flags & MDF_OPEN)
-    result = fclose (md->file);
+int _md_close (struct _md *md)
+{
+  if (md->flags & MDF_ALLOC)
+    free ((char *)md->buffer);
   free (md);
-  return result;
+  return 0;
 }
@@ -1,24 +1,462 @@
 /* moddef2.c (emx+gcc) -- Copyright (c) 1992-1995 by Eberhard Mattes */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/moddef.h>
+#include "moddef0.h"
+
+#if defined (USE_THREADS)
+#include <pthread.h>
+#endif
 
 #define FALSE 0
 #define TRUE  1
 
+#define BATCH_SIZE 256          /* Exports per call of the batch callback */
+#define POOL_SIZE  0x4000       /* Size of a block of the name pool */
+#define NAME_LEN   255          /* Names are truncated to this length */
+#define MIN_CHUNK  0x10000      /* Minimum size of an EXPORTS chunk */
+
 typedef int _md_callback (struct _md *md, const _md_stmt *stmt,
                           _md_token token, void *arg);
+typedef int _md_batch_callback (struct _md *md, const _md_export *exports,
+                                int count, void *arg);
+
+/* A block of the name pool of _md_parse_batch(). */
+
+struct pool
+{
+  struct pool *next;
+  char data[POOL_SIZE];
+};
+
+/* The state of _md_parse_batch(): the exports not yet passed to the
+   callback, and the pool holding their names.  The pool is reused for
+   each chunk. */
+
+struct batch
+{
+  _md_batch_callback *callback;
+  _md_export tab[BATCH_SIZE];
+  int count;
+  struct pool *pool;            /* First block */
+  struct pool *pool_cur;        /* Current block */
+  size_t pool_used;             /* Bytes used in the current block */
+};
+
+/* An entry of an EXPORTS statement, as found in the text. */
+
+struct export_text
+{
+  const char *pos;              /* Start of the entry */
+  const char *entry;
+  const char *internal;         /* NULL if not given */
+  size_t entry_len;
+  size_t internal_len;
+  int ordinal;
+  int pwords;
+  unsigned flags;
+  long linenumber;
+};
+
+/* Copy the string SRC of length LEN to DST, truncating it to SIZE-1
+   characters. */
+
+static void copy_text (char *dst, size_t size, const char *src, size_t len)
+{
+  if (len > size - 1)
+    len = size - 1;
+  if (len != 0)
+    memcpy (dst, src, len);
+  dst[len] = 0;
+}
+
+/* Copy the current token to DST, truncating it to SIZE-1 characters. */
+
+static void copy_token (struct _md *md, char *dst, size_t size)
+{
+  const char *src;
+  size_t len;
+
+  src = _md_get_text (md, &len);
+  copy_text (dst, size, src, len);
+}
+
+/* Store a copy of the string S of length LEN in the name pool and
+   return a pointer to it.  Return NULL if out of memory. */
+
+static const char *store_name (struct batch *b, const char *s, size_t len)
+{
+  struct pool *pool;
+  char *p;
+
+  if (len > NAME_LEN)
+    len = NAME_LEN;
+  if (b->pool_cur == NULL || b->pool_used + len + 1 > POOL_SIZE)
+    {
+      pool = (b->pool_cur == NULL ? b->pool : b->pool_cur->next);
+      if (pool == NULL)
+        {
+          pool = malloc (sizeof (*pool));
+          if (pool == NULL)
+            return NULL;
+          pool->next = NULL;
+          if (b->pool_cur == NULL)
+            b->pool = pool;
+          else
+            b->pool_cur->next = pool;
+        }
+      b->pool_cur = pool; b->pool_used = 0;
+    }
+  p = b->pool_cur->data + b->pool_used;
+  copy_text (p, len + 1, s, len);
+  b->pool_used += len + 1;
+  return p;
+}
+
+/* Pass the collected exports to the batch callback. */
+
+static int flush_batch (struct _md *md, struct batch *b, void *arg)
+{
+  int count;
+
+  count = b->count;
+  if (count == 0)
+    return 0;
+  b->count = 0;
+  b->pool_cur = NULL; b->pool_used = 0;
+  return b->callback (md, b->tab, count, arg);
+}
+
+/* Parse an entry of an EXPORTS statement into *E.  The current token,
+   *PTOKEN, is the entry name.  On success, store the token following
+   the entry to *PTOKEN and return TRUE.  On error, store the error code
+   to *PCODE and return FALSE. */
+
+static int parse_export (struct _md *md, _md_token *ptoken,
+                         struct export_text *e, _md_error *pcode)
+{
+  _md_token token;
+  long n;
+
+  e->pos = md->start;
+  e->linenumber = _md_get_linenumber (md);
+  e->entry = _md_get_text (md, &e->entry_len);
+  e->internal = NULL; e->internal_len = 0;
+  e->ordinal = 0; e->pwords = 0; e->flags = 0;
+  token = _md_next_token (md);
+  if (token == _MD_equal)
+    {
+      token = _md_next_token (md);
+      if (token != _MD_quote && token != _MD_word)
+        {
+          *pcode = _MDE_NAME_EXPECTED;
+          return FALSE;
+        }
+      e->internal = _md_get_text (md, &e->internal_len);
+      token = _md_next_token (md);
+    }
+  if (token == _MD_at)
+    {
+      e->flags |= _MDEP_ORDINAL;
+      token = _md_next_token (md);
+      if (token != _MD_number)
+        {
+          *pcode = _MDE_NUMBER_EXPECTED;
+          return FALSE;
+        }
+      n = _md_get_number (md);
+      if (n < 1 || n > 65535)
+        {
+          *pcode = _MDE_INVALID_ORDINAL;
+          return FALSE;
+        }
+      e->ordinal = n;
+      token = _md_next_token (md);
+      if (token == _MD_NONAME)
+        {
+          e->flags |= _MDEP_NONAME;
+          token = _md_next_token (md);
+        }
+      else if (token == _MD_RESIDENTNAME)
+        {
+          e->flags |= _MDEP_RESIDENTNAME;
+          token = _md_next_token (md);
+        }
+    }
+  if (token == _MD_NODATA)
+    {
+      e->flags |= _MDEP_NODATA;
+      token = _md_next_token (md);
+    }
+  if (token == _MD_number)
+    {
+      e->flags |= _MDEP_PWORDS;
+      e->pwords = _md_get_number (md);
+      token = _md_next_token (md);
+    }
+  *ptoken = token;
+  return TRUE;
+}
+
+
+/* Add the export E to the batch, passing the batch to the callback
+   first if it is full.  Return the result of the callback.  Set *OK
+   to FALSE if out of memory. */
+
+static int add_export (struct _md *md, struct batch *b,
+                       const struct export_text *e, void *arg, int *ok)
+{
+  _md_export *exp;
+  int result;
+
+  if (b->count == BATCH_SIZE)
+    {
+      result = flush_batch (md, b, arg);
+      if (result != 0)
+        return result;
+    }
+  exp = &b->tab[b->count];
+  exp->entryname = store_name (b, e->entry, e->entry_len);
+  exp->internalname = NULL;
+  if (e->internal != NULL && e->internal_len == e->entry_len
+      && memcmp (e->internal, e->entry, e->entry_len) == 0)
+    exp->internalname = exp->entryname;
+  else if (e->internal != NULL)
+    exp->internalname = store_name (b, e->internal, e->internal_len);
+  if (exp->entryname == NULL
+      || (e->internal != NULL && exp->internalname == NULL))
+    {
+      *ok = FALSE;
+      return 0;
+    }
+  exp->ordinal = e->ordinal;
+  exp->pwords = e->pwords;
+  exp->flags = e->flags;
+  exp->linenumber = e->linenumber;
+  ++b->count;
+  return 0;
+}
+
+
+#if defined (USE_THREADS)
+
+/* A part of the text following the first entry of an EXPORTS
+   statement.  Each chunk but the first one starts at the beginning of
+   a line and is parsed by a separate thread, assuming that an entry
+   starts there.  Line numbers are relative to the start of the
+   chunk. */
+
+struct chunk
+{
+  const char *start;            /* Start of the text */
+  const char *end;              /* End of the text */
+  pthread_t thread;
+  int running;                  /* The thread has been created */
+  _md_token first;              /* The first token, or _MD_parseerror */
+  struct export_text *tab;      /* The entries parsed */
+  int count;
+  int alloc;
+  const char *stop;             /* Where parsing stopped, or NULL */
+  long stop_line;
+  long last_line;               /* Number of the last line */
+  long lines;                   /* Number of newline characters */
+};
+
+
+/* Parse the entries in the chunk ARG, up to the first token which does
+   not start an entry, the first error, or the end of the chunk. */
+
+static void *parse_chunk (void *arg)
+{
+  struct chunk *c;
+  struct _md *md;
+  struct export_text e, *tab;
+  _md_token token;
+  _md_error code;
+  const char *p;
+  int n;
+
+  c = arg;
+  c->tab = NULL; c->count = 0; c->alloc = 0;
+  c->first = _MD_parseerror;
+  c->stop = c->start; c->stop_line = 1; c->last_line = 1;
+  md = _md_use_buffer (c->start, c->end - c->start);
+  if (md != NULL)
+    {
+      token = c->first = _md_next_token (md);
+      while (token == _MD_quote || token == _MD_word)
+        {
+          c->stop = md->start; c->stop_line = _md_get_linenumber (md);
+          if (c->count >= c->alloc)
+            {
+              n = (c->alloc == 0 ? 1024 : 2 * c->alloc);
+              tab = realloc (c->tab, n * sizeof (*tab));
+              if (tab == NULL)
+                break;
+              c->tab = tab; c->alloc = n;
+            }
+          if (!parse_export (md, &token, &e, &code))
+            break;
+          c->tab[c->count++] = e;
+        }
+      if (token != _MD_quote && token != _MD_word)
+        {
+          c->stop = (token == _MD_eof ? NULL : md->start);
+          c->stop_line = _md_get_linenumber (md);
+        }
+      c->last_line = _md_get_linenumber (md);
+      _md_close (md);
+    }
+  c->lines = 0;
+  for (p = c->start; (p = memchr (p, '\n', c->end - p)) != NULL; ++p)
+    ++c->lines;
+  return NULL;
+}
 
-static int error (struct _md *md, _md_callback *callback, _md_stmt *stmt,
-                  _md_token stmt_token, _md_error code, void *arg)
+
+/* Parse the entries of the EXPORTS statement whose first entry name is
+   the current token, using up to MD->threads threads.  The text is
+   split at line boundaries into chunks which are parsed in parallel.
+   The entries are then added to the batch in order.  If a chunk does
+   not start with an entry name, the last entry of the preceding chunk
+   may continue in that chunk, so parsing resumes at that entry in the
+   current thread, as it does at the first error or at the end of the
+   EXPORTS statement.  Store the token at which parsing resumes to
+   *PTOKEN and return the result of the callback. */
+
+static int parse_exports_mt (struct _md *md, struct batch *b,
+                             _md_token *ptoken, void *arg)
 {
+  struct chunk *chunks, *c;
+  struct export_text *held, *e;
+  const char *p, *resume;
+  long line, resume_line;
+  size_t size;
+  int i, j, n, ok, result;
+
+  size = md->end - md->start;
+  n = md->threads;
+  if (n > size / MIN_CHUNK)
+    n = size / MIN_CHUNK;
+  if (n < 2)
+    return 0;
+  chunks = malloc (n * sizeof (*chunks));
+  if (chunks == NULL)
+    return 0;
+  p = md->start;
+  for (i = 0; i < n && p != md->end; ++i)
+    {
+      chunks[i].start = p;
+      if (i == n - 1)
+        p = md->end;
+      else
+        {
+          p = md->start + (size / n) * (i + 1);
+          if (p < chunks[i].start)
+            p = chunks[i].start;
+          p = memchr (p, '\n', md->end - p);
+          p = (p == NULL ? md->end : p + 1);
+        }
+      chunks[i].end = p;
+    }
+  n = i;
+  for (i = 1; i < n; ++i)
+    chunks[i].running = (pthread_create (&chunks[i].thread, NULL,
+                                         parse_chunk, &chunks[i]) == 0);
+  parse_chunk (&chunks[0]);
+  for (i = 1; i < n; ++i)
+    if (chunks[i].running)
+      pthread_join (chunks[i].thread, NULL);
+    else
+      parse_chunk (&chunks[i]);
+
+  result = 0; ok = TRUE; held = NULL;
+  line = _md_get_linenumber (md);
+  resume = md->end; resume_line = line;
+  for (i = 0; i < n; ++i)
+    {
+      c = &chunks[i];
+      for (j = 0; j < c->count; ++j)
+        c->tab[j].linenumber += line - 1;
+      if (c->first != _MD_eof)
+        {
+          if (c->first != _MD_quote && c->first != _MD_word)
+            {
+              if (held != NULL)
+                {
+                  resume = held->pos; resume_line = held->linenumber;
+                }
+              else
+                {
+                  resume = c->start; resume_line = line;
+                }
+              held = NULL;
+              break;
+            }
+          for (j = -1; j < c->count - 1; ++j)
+            {
+              e = (j == -1 ? held : &c->tab[j]);
+              if (e == NULL)
+                continue;
+              result = add_export (md, b, e, arg, &ok);
+              if (result != 0 || !ok)
+                {
+                  resume = e->pos; resume_line = e->linenumber;
+                  held = NULL;
+                  goto done;
+                }
+            }
+          held = (c->count != 0 ? &c->tab[c->count - 1] : NULL);
+        }
+      if (c->stop != NULL)
+        {
+          resume = c->stop; resume_line = line + c->stop_line - 1;
+          break;
+        }
+      resume_line = line + c->last_line - 1;
+      line += c->lines;
+    }
+  if (held != NULL)
+    {
+      result = add_export (md, b, held, arg, &ok);
+      if (!ok)
+        {
+          resume = held->pos; resume_line = held->linenumber;
+        }
+    }
+
+done:
+  for (i = 0; i < n; ++i)
+    free (chunks[i].tab);
+  free (chunks);
+  _md_set_position (md, resume, resume_line);
+  *ptoken = _md_next_token (md);
+  return result;
+}
+
+#endif
+
+
+static int error (struct _md *md, _md_callback *callback, struct batch *batch,
+                  _md_stmt *stmt, _md_token stmt_token, _md_error code,
+                  void *arg)
+{
+  int result;
+
+  if (batch != NULL)
+    {
+      result = flush_batch (md, batch, arg);
+      if (result != 0)
+        return result;
+    }
   stmt->error.code = code;
   stmt->error.stmt = stmt_token;
   return callback (md, stmt, _MD_parseerror, arg);
 }
 
-static _md_token sync (struct _md *md)
+static _md_token resync (struct _md *md)
 {
   _md_token token;
 
@@ -52,19 +490,27 @@ static _md_token sync (struct _md *md)
 
 
 #define ERROR(CODE) \
-  do { result = error (md, callback, &stmt, stmt_token, (CODE), arg); \
+  do { result = error (md, callback, batch, &stmt, stmt_token, (CODE), \
+                       arg); \
        if (result != 0) return result; \
-       token = sync (md); goto next_stmt;} while (FALSE)
+       token = resync (md); goto next_stmt;} while (FALSE)
 
 #define CALLBACK \
   do { result = callback (md, &stmt, stmt_token, arg); \
        if (result != 0) return result; } while (FALSE)
 
-int _md_parse (struct _md *md, _md_callback *callback, void *arg)
+/* Parse the module definition file.  If BATCH is non-NULL, pass the
+   entries of EXPORTS statements in chunks to BATCH->callback instead
+   of calling CALLBACK for each entry. */
+
+static int parse (struct _md *md, _md_callback *callback,
+                  struct batch *batch, void *arg)
 {
   _md_token token, stmt_token;
   _md_stmt stmt;
-  const char *s;
+  struct export_text e;
+  _md_error code;
+  size_t len;
   long n;
   int ok, result;
 
@@ -81,8 +527,7 @@ int _md_parse (struct _md *md, _md_callback *callback, void *arg)
       stmt.name.name[0] = 0;
       if (token == _MD_quote || token == _MD_word)
         {
-          _strncpy (stmt.name.name, _md_get_string (md),
-                    sizeof (stmt.name.name));
+          copy_token (md, stmt.name.name, sizeof (stmt.name.name));
           token = _md_next_token (md);
         }
       switch (token)
@@ -116,8 +561,7 @@ int _md_parse (struct _md *md, _md_callback *callback, void *arg)
       token = _md_next_token (md);
       if (token == _MD_quote || token == _MD_word)
         {
-          _strncpy (stmt.library.name, _md_get_string (md),
-                    sizeof (stmt.library.name));
+          copy_token (md, stmt.library.name, sizeof (stmt.library.name));
           token = _md_next_token (md);
         }
       switch (token)
@@ -162,8 +606,7 @@ int _md_parse (struct _md *md, _md_callback *callback, void *arg)
       stmt.device.name[0] = 0;
       if (token == _MD_quote || token == _MD_word)
         {
-          _strncpy (stmt.device.name, _md_get_string (md),
-                    sizeof (stmt.device.name));
+          copy_token (md, stmt.device.name, sizeof (stmt.device.name));
           token = _md_next_token (md);
         }
       CALLBACK;
@@ -320,10 +763,10 @@ next_stmt:
           token = _md_next_token (md);
           if (token != _MD_quote)
             ERROR (_MDE_STRING_EXPECTED);
-          s = _md_get_string (md);
-          if (*s == 0 || strlen (s) > 255)
+          _md_get_text (md, &len);
+          if (len == 0 || len > 255)
             ERROR (_MDE_STRING_TOO_LONG);
-          _strncpy (stmt.descr.string, s, sizeof (stmt.descr.string));
+          copy_token (md, stmt.descr.string, sizeof (stmt.descr.string));
           token = _md_next_token (md);
           CALLBACK;
           break;
@@ -369,58 +812,45 @@ next_stmt:
 
         case _MD_EXPORTS:
           token = _md_next_token (md);
+#if defined (USE_THREADS)
+          if (batch != NULL && md->threads > 1
+              && (token == _MD_quote || token == _MD_word))
+            {
+              result = parse_exports_mt (md, batch, &token, arg);
+              if (result != 0)
+                return result;
+            }
+#endif
           while (token == _MD_quote || token == _MD_word)
             {
-              stmt.export.ordinal = 0;
-              stmt.export.pwords = 0;
-              stmt.export.flags = 0;
-              stmt.export.internalname[0] = 0;
-              _strncpy (stmt.export.entryname, _md_get_string (md),
-                        sizeof (stmt.export.entryname));
-              token = _md_next_token (md);
-              if (token == _MD_equal)
-                {
-                  token = _md_next_token (md);
-                  if (token != _MD_quote && token != _MD_word)
-                    ERROR (_MDE_NAME_EXPECTED);
-                  _strncpy (stmt.export.internalname, _md_get_string (md),
-                            sizeof (stmt.export.internalname));
-                  token = _md_next_token (md);
-                }
-              if (token == _MD_at)
-                {
-                  stmt.export.flags |= _MDEP_ORDINAL;
-                  token = _md_next_token (md);
-                  if (token != _MD_number)
-                    ERROR (_MDE_NUMBER_EXPECTED);
-                  n = _md_get_number (md);
-                  if (n < 1 || n > 65535)
-                    ERROR (_MDE_INVALID_ORDINAL);
-                  stmt.export.ordinal = n;
-                  token = _md_next_token (md);
-                  if (token == _MD_NONAME)
-                    {
-                      stmt.export.flags |= _MDEP_NONAME;
-                      token = _md_next_token (md);
-                    }
-                  else if (token == _MD_RESIDENTNAME)
-                    {
-                      stmt.export.flags |= _MDEP_RESIDENTNAME;
-                      token = _md_next_token (md);
-                    }
-                }
-              if (token == _MD_NODATA)
-                {
-                  stmt.export.flags |= _MDEP_NODATA;
-                  token = _md_next_token (md);
-                }
-              if (token == _MD_number)
+              if (!parse_export (md, &token, &e, &code))
+                ERROR (code);
+              if (batch == NULL)
                 {
-                  stmt.export.flags |= _MDEP_PWORDS;
-                  stmt.export.pwords = _md_get_number (md);
-                  token = _md_next_token (md);
+                  stmt.export.ordinal = e.ordinal;
+                  stmt.export.pwords = e.pwords;
+                  stmt.export.flags = e.flags;
+                  copy_text (stmt.export.entryname,
+                             sizeof (stmt.export.entryname),
+                             e.entry, e.entry_len);
+                  copy_text (stmt.export.internalname,
+                             sizeof (stmt.export.internalname),
+                             e.internal, e.internal_len);
+                  CALLBACK;
+                  continue;
                 }
-              CALLBACK;
+              ok = TRUE;
+              result = add_export (md, batch, &e, arg, &ok);
+              if (result != 0)
+                return result;
+              if (!ok)
+                ERROR (_MDE_NO_MEMORY);
+            }
+          if (batch != NULL)
+            {
+              result = flush_batch (md, batch, arg);
+              if (result != 0)
+                return result;
             }
           break;
 
@@ -446,8 +876,8 @@ next_stmt:
           token = _md_next_token (md);
           while (token == _MD_quote || token == _MD_word)
             {
-              _strncpy (stmt.import.modulename, _md_get_string (md),
-                        sizeof (stmt.import.modulename));
+              copy_token (md, stmt.import.modulename,
+                          sizeof (stmt.import.modulename));
               stmt.import.entryname[0] = 0;
               stmt.import.internalname[0] = 0;
               stmt.import.ordinal = 0;
@@ -460,16 +890,16 @@ next_stmt:
                   token = _md_next_token (md);
                   if (token != _MD_quote && token != _MD_word)
                     ERROR (_MDE_NAME_EXPECTED);
-                  _strncpy (stmt.import.modulename, _md_get_string (md),
-                            sizeof (stmt.import.modulename));
+                  copy_token (md, stmt.import.modulename,
+                              sizeof (stmt.import.modulename));
                   token = _md_next_token (md);
                 }
               if (token != _MD_dot)
                 ERROR (_MDE_DOT_EXPECTED);
               token = _md_next_token (md);
               if (token == _MD_word)
-                _strncpy (stmt.import.entryname, _md_get_string (md),
-                          sizeof (stmt.import.entryname));
+                copy_token (md, stmt.import.entryname,
+                            sizeof (stmt.import.entryname));
               else if (token == _MD_number)
                 {
                   stmt.import.flags |= _MDIP_ORDINAL;
@@ -489,8 +919,7 @@ next_stmt:
           token = _md_next_token (md);
           if (token != _MD_quote)
             ERROR (_MDE_STRING_EXPECTED);
-          _strncpy (stmt.old.name, _md_get_string (md),
-                    sizeof (stmt.old.name));
+          copy_token (md, stmt.old.name, sizeof (stmt.old.name));
           token = _md_next_token (md);
           CALLBACK;
           break;
@@ -505,16 +934,16 @@ next_stmt:
           token = _md_next_token (md);
           while (token == _MD_quote || token == _MD_word)
             {
-              _strncpy (stmt.segment.segname, _md_get_string (md),
-                        sizeof (stmt.segment.segname));
+              copy_token (md, stmt.segment.segname,
+                          sizeof (stmt.segment.segname));
               token = _md_next_token (md);
               if (token == _MD_CLASS)
                 {
                   token = _md_next_token (md);
                   if (token != _MD_quote && token != _MD_word)
                     ERROR (_MDE_NAME_EXPECTED);
-                  _strncpy (stmt.segment.classname, _md_get_string (md),
-                            sizeof (stmt.segment.classname));
+                  copy_token (md, stmt.segment.classname,
+                              sizeof (stmt.segment.classname));
                   token = _md_next_token (md);
                 }
               else
@@ -608,8 +1037,7 @@ next_stmt:
           token = _md_next_token (md);
           if (token == _MD_quote)
             {
-              _strncpy (stmt.stub.name, _md_get_string (md),
-                        sizeof (stmt.stub.name));
+              copy_token (md, stmt.stub.name, sizeof (stmt.stub.name));
               stmt.stub.none = FALSE;
             }
           else if (token == _MD_NONE)
@@ -637,3 +1065,33 @@ next_stmt:
     }
   return 0;
 }
+
+
+int _md_parse (struct _md *md, _md_callback *callback, void *arg)
+{
+  return parse (md, callback, NULL, arg);
+}
+
+
+/* Like _md_parse(), but pass the entries of EXPORTS statements in
+   chunks to BATCH_CALLBACK.  The names of the exports are truncated to
+   255 characters; they remain valid until BATCH_CALLBACK returns. */
+
+int _md_parse_batch (struct _md *md, _md_callback *callback,
+                     _md_batch_callback *batch_callback, void *arg)
+{
+  struct batch b;
+  struct pool *p1, *p2;
+  int result;
+
+  b.callback = batch_callback;
+  b.count = 0;
+  b.pool = NULL; b.pool_cur = NULL; b.pool_used = 0;
+  result = parse (md, callback, &b, arg);
+  for (p1 = b.pool; p1 != NULL; p1 = p2)
+    {
+      p2 = p1->next;
+      free (p1);
+    }
+  return result;
+}
@@ -29,6 +29,8 @@ const char *_md_errmsg (_md_error code)
       return "Invalid ordinal number";
     case _MDE_INVALID_STMT:
       return "Invalid statement";
+    case _MDE_NO_MEMORY:
+      return "Out of memory";
     default:
       return "Unknown error";
     }
@@ -12,6 +12,14 @@ typedef unsigned long dword;
 
 #define FLAG_DELETED  0x0001
 
+/* Size of the output buffer of a library being created. */
+
+#define OUT_BUF_SIZE  0x10000
+
+/* Minimum size of a block of the string arena. */
+
+#define STR_BLOCK_SIZE 0x8000
+
 enum omf_state
 {
   OS_EMPTY,                     /* Empty module */
@@ -26,9 +34,43 @@ struct omfmod
   word flags;
 };
 
+/* The raw dictionary hash values of a symbol name.  They are reduced
+   modulo the number of dictionary blocks and modulo 37 buckets by
+   omflib_hash_set(). */
+
+struct omfhash
+{
+  word block_index;
+  word block_index_delta;
+  word bucket_index;
+  word bucket_index_delta;
+};
+
+/* A block of the string arena of a library.  The names of the public
+   symbols and of the modules are stored in the arena, which is freed
+   as a whole by omflib_close(). */
+
+struct str_block
+{
+  struct str_block *next;
+  int size;                     /* Size of data[] */
+  int used;                     /* Bytes used in data[] */
+  char data[1];
+};
+
+/* The fill level of the string arena, see omflib_str_mark(). */
+
+struct str_mark
+{
+  struct str_block *block;
+  int used;
+};
+
 struct pubsym
 {
   word page;
+  word len;
+  struct omfhash hash;          /* Computed by omflib_add_pub() */
   char *name;
 };
 
@@ -42,6 +84,8 @@ struct omflib
   struct omfmod *mod_tab;
   int mod_alloc;
   int mod_count;
+  int *mod_hash;                /* Module index + 1 by name, or 0 */
+  int mod_hash_size;            /* Number of entries, a power of two */
   byte *dict;
   int block_index;
   int block_index_delta;
@@ -50,6 +94,13 @@ struct omflib
   struct pubsym *pub_tab;
   int pub_alloc;
   int pub_count;
+  struct str_block *str_arena;  /* Current block of the string arena */
+  int allocs;                   /* Number of tables and blocks allocated */
+  long alloc_bytes;             /* Total size of these allocations */
+  int dict_retries;
+  byte *out_buf;                /* Output buffer (output library only) */
+  int out_len;                  /* Number of bytes in out_buf */
+  long out_pos;                 /* File position of out_buf */
   char output;
   word mod_page;
   enum omf_state state;
@@ -82,9 +133,21 @@ struct lib_header
 #pragma pack()
 
 int omflib_set_error (char *error);
+char *omflib_str_copy (struct omflib *p, const char *s, int len);
+void omflib_str_mark (struct omflib *p, struct str_mark *mark);
+void omflib_str_release (struct omflib *p, const struct str_mark *mark);
+int omflib_add_mod (struct omflib *p, const char *name, word page,
+    char *error);
 int omflib_read_dictionary (struct omflib *p, char *error);
 void omflib_hash (struct omflib *p, const byte *name);
-int omflib_pad (FILE *f, int size, int force, char *error);
+void omflib_hash_raw (const byte *name, struct omfhash *h);
+void omflib_hash_set (struct omflib *p, const struct omfhash *h);
+int omflib_probe (struct omflib *p, const byte *buf, const struct omfhash *h,
+                  int *probes);
+int omflib_pad (struct omflib *p, int size, int force, char *error);
+long omflib_tell (struct omflib *p);
+int omflib_write (struct omflib *p, const void *src, int len, char *error);
+int omflib_flush (struct omflib *p, char *error);
 int omflib_copy_module (struct omflib *dst_lib, FILE *dst_file,
     struct omflib *src_lib, FILE *src_file, const char *mod_name, char *error);
 int omflib_make_mod_tab (struct omflib *p, char *error);
@@ -11,32 +11,78 @@
 
 int omflib_add_pub (struct omflib *p, const char *name, word page, char *error)
 {
-  int i;
+  int i, n, len;
+  byte buf[256];
+  struct pubsym *tab;
 
   if (strncmp (name, "__POST$", 7) == 0)
     return 0;
 
+  /* Double the size of the table to keep the number of reallocations
+     logarithmic in the number of symbols. */
+
   if (p->pub_count >= p->pub_alloc)
     {
-      p->pub_alloc += 32;
-      p->pub_tab = realloc (p->pub_tab,
-                            p->pub_alloc * sizeof (struct pubsym));
-      if (p->pub_tab == NULL)
+      n = (p->pub_alloc == 0 ? 64 : 2 * p->pub_alloc);
+      tab = realloc (p->pub_tab, n * sizeof (struct pubsym));
+      if (tab == NULL)
         {
           errno = ENOMEM;
-          strcpy (error, strerror (errno));
-          p->pub_alloc = 0;
-          p->pub_count = 0;
-          return -1;
+          return omflib_set_error (error);
         }
+      p->pub_tab = tab;
+      p->pub_alloc = n;
+      ++p->allocs;
+      p->alloc_bytes += n * sizeof (struct pubsym);
     }
   i = p->pub_count;
-  if ((p->pub_tab[i].name = strdup (name)) == NULL)
+  len = strlen (name);
+  if ((p->pub_tab[i].name = omflib_str_copy (p, name, len)) == NULL)
+    return omflib_set_error (error);
+  p->pub_tab[i].page = page;
+
+  /* Hash the name now; omflib_finish() checks the length. */
+
+  p->pub_tab[i].len = (len > 255 ? 256 : len);
+  if (len <= 255)
     {
-      errno = ENOMEM;
-      return omflib_set_error (error);
+      buf[0] = (byte)len;
+      memcpy (buf+1, name, len);
+      omflib_hash_raw (buf, &p->pub_tab[i].hash);
     }
-  p->pub_tab[i].page = page;
   ++p->pub_count;
   return 0;
 }
+
+
+/* Record the module NAME starting at PAGE of the output library P, for
+   omflib_write_index(). */
+
+int omflib_add_mod (struct omflib *p, const char *name, word page,
+                    char *error)
+{
+  int n;
+  struct omfmod *tab;
+
+  if (p->mod_count >= p->mod_alloc)
+    {
+      n = (p->mod_alloc == 0 ? 64 : 2 * p->mod_alloc);
+      tab = realloc (p->mod_tab, n * sizeof (struct omfmod));
+      if (tab == NULL)
+        {
+          errno = ENOMEM;
+          return omflib_set_error (error);
+        }
+      p->mod_tab = tab;
+      p->mod_alloc = n;
+      ++p->allocs;
+      p->alloc_bytes += n * sizeof (struct omfmod);
+    }
+  tab = &p->mod_tab[p->mod_count];
+  if ((tab->name = omflib_str_copy (p, name, strlen (name))) == NULL)
+    return omflib_set_error (error);
+  tab->page = page;
+  tab->flags = 0;
+  ++p->mod_count;
+  return 0;
+}
@@ -5,37 +5,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <errno.h>
 #include "omflib0.h"
 #include <sys/omflib.h>
 
 
 int omflib_copy_lib (struct omflib *dst, struct omflib *src, char *error)
 {
-  int i, rc, *reverse;
+  int i, rc, next;
   long long_page;
   struct omf_rec rec;
 
   if (src->mod_count == -1 && omflib_make_mod_tab (src, error) != 0)
     return -1;
 
-  /* Build a vector which maps page numbers to module table
-     entries. */
-
-  reverse = malloc (65536 * sizeof (*reverse));
-  if (reverse == NULL)
-    {
-      errno = ENOMEM;
-      return omflib_set_error (error);
-    }
-
-  for (i = 0; i < 65536; ++i)
-    reverse[i] = -1;
-  for (i = 0; i < src->mod_count; ++i)
-    reverse[src->mod_tab[i].page] = i;
-
-  /* Now read the source library sequentially, starting on page 1. */
+  /* Read the source library sequentially, starting on page 1.  As the
+     module table is sorted by page number, the module table entry of
+     each module is found by walking the table in parallel.  If there
+     are multiple entries for a page, the last one is used. */
 
+  next = 0;
   fseek (src->f, src->page_size, SEEK_SET);
   for (;;)
     {
@@ -43,13 +31,11 @@ int omflib_copy_lib (struct omflib *dst, struct omflib *src, char *error)
       if (long_page == -1)
         {
           omflib_set_error (error);
-          free (reverse);
           return -1;
         }
       if (long_page > 65535)
         {
           strcpy (error, "Source library too big");
-          free (reverse);
           return -1;
         }
       if (fread (&rec, sizeof (rec), 1, src->f) != 1)
@@ -58,7 +44,6 @@ int omflib_copy_lib (struct omflib *dst, struct omflib *src, char *error)
             omflib_set_error (error);
           else
             strcpy (error, "Unexpected end of file");
-          free (reverse);
           return -1;
         }
       if (rec.rec_type == LIBEND)
@@ -66,11 +51,14 @@ int omflib_copy_lib (struct omflib *dst, struct omflib *src, char *error)
       if (rec.rec_type != THEADR)
         {
           strcpy (error, "THEADR or LIBEND expected");
-          free (reverse);
           return -1;
         }
       fseek (src->f, -sizeof (rec), SEEK_CUR);
-      i = reverse[long_page];
+      while (next < src->mod_count && src->mod_tab[next].page < long_page)
+        ++next;
+      i = -1;
+      while (next < src->mod_count && src->mod_tab[next].page == long_page)
+        i = next++;
       if (i == -1)
         {
           /* Unknown module, perhaps an import definition.  Copy the
@@ -89,11 +77,7 @@ int omflib_copy_lib (struct omflib *dst, struct omflib *src, char *error)
                                    src->mod_tab[i].name, error);
         }
       if (rc != 0)
-        {
-          free (reverse);
-          return rc;
-        }
+        return rc;
     }
-  free (reverse);
   return 0;
 }
@@ -9,11 +9,16 @@
 #include <sys/omflib.h>
 
 
+enum rec_kind {RT_THEADR, RT_OTHER};
+
 static struct omflib *pubdef_dst_lib;
 static word pubdef_page;
 
 
 static int add_pubdef (const char *name, char *error);
+static int copy_block (struct omflib *dst_lib, FILE *src_file,
+    const char *caller_name, int libmod, word page, enum omf_state *pstate,
+    char *theadr_name, char *libmod_name, char *error);
 
 
 int omflib_copy_module (struct omflib *dst_lib, FILE *dst_file,
@@ -28,7 +33,7 @@ int omflib_copy_module (struct omflib *dst_lib, FILE *dst_file,
   char caller_name[256];
   byte buf[1024], buf2[256+6];
   enum omf_state state;
-  enum {RT_THEADR, RT_OTHER} cur_rt, prev_rt;
+  enum rec_kind cur_rt, prev_rt;
   int copy;
 
   theadr_name[0] = 0; libmod_name[0] = 0;
@@ -38,7 +43,7 @@ int omflib_copy_module (struct omflib *dst_lib, FILE *dst_file,
     omflib_module_name (caller_name, mod_name);
   if (dst_lib != NULL)
     {
-      long_page = ftell (dst_file) / dst_lib->page_size;
+      long_page = omflib_tell (dst_lib) / dst_lib->page_size;
       if (long_page > 65535)
         {
           strcpy (error, "Library too big -- increase page size");
@@ -48,6 +53,18 @@ int omflib_copy_module (struct omflib *dst_lib, FILE *dst_file,
     }
   else
     page = 0;
+  state = OS_EMPTY;
+  if (dst_lib != NULL && dst_file != NULL)
+    switch (copy_block (dst_lib, src_file, caller_name, mod_name != NULL,
+                        page, &state, theadr_name, libmod_name, error))
+      {
+      case -1:
+        return -1;
+      case 1:
+        goto copied;
+      default:
+        break;
+      }
   state = OS_EMPTY; prev_rt = RT_OTHER;
   do
     {
@@ -69,8 +86,11 @@ int omflib_copy_module (struct omflib *dst_lib, FILE *dst_file,
               strcpy (error, "Truncated THEADR record");
               return -1;
             }
-          buf[1+buf[0]] = 0;
-          omflib_module_name (theadr_name, buf + 1);
+          /* Don't touch BUF, it is copied to the output. */
+
+          memcpy (buf2, buf + 1, buf[0]);
+          buf2[buf[0]] = 0;
+          omflib_module_name (theadr_name, buf2);
           state = OS_EMPTY; cur_rt = RT_THEADR;
           break;
 
@@ -119,8 +139,9 @@ int omflib_copy_module (struct omflib *dst_lib, FILE *dst_file,
                   strcpy (error, "Truncated LIBMOD record");
                   return -1;
                 }
-              buf[3+buf[2]] = 0;
-              omflib_module_name (libmod_name, buf + 3);
+              memcpy (buf2, buf + 3, buf[2]);
+              buf2[buf[2]] = 0;
+              omflib_module_name (libmod_name, buf2);
               state = OS_OTHER;
             }
           else
@@ -153,12 +174,22 @@ int omflib_copy_module (struct omflib *dst_lib, FILE *dst_file,
         }
       if (copy && dst_file != NULL)
         {
-          if (fwrite (&rec, sizeof (rec), 1, dst_file) != 1
-              || fwrite (buf, rec.rec_len, 1, dst_file) != 1)
+          /* DST_FILE is the file of DST_LIB if DST_LIB is not NULL. */
+
+          if (dst_lib != NULL)
+            {
+              if (omflib_write (dst_lib, &rec, sizeof (rec), error) != 0
+                  || omflib_write (dst_lib, buf, rec.rec_len, error) != 0)
+                return -1;
+            }
+          else if (fwrite (&rec, sizeof (rec), 1, dst_file) != 1
+                   || fwrite (buf, rec.rec_len, 1, dst_file) != 1)
             return omflib_set_error (error);
         }
       prev_rt = cur_rt;
     } while (rec.rec_type != MODEND && rec.rec_type != (MODEND|REC32));
+
+copied:
   if (src_lib != NULL)
     {
       pos = ftell (src_file);
@@ -168,23 +199,27 @@ int omflib_copy_module (struct omflib *dst_lib, FILE *dst_file,
     }
   if (dst_lib != NULL)
     {
+      if (caller_name[0] != 0)
+        strcpy (buf2, caller_name);
+      else if (libmod_name[0] != 0)
+        strcpy (buf2, libmod_name);
+      else
+        strcpy (buf2, theadr_name);
+      if (dst_file != NULL
+          && omflib_add_mod (dst_lib, (const char *)buf2, page, error) != 0)
+        return -1;
+
       /* Don't use PUBDEF for the module name for modules that contain
          only an alias or an import definition. */
 
       if (state != OS_SIMPLE)
         {
-          if (caller_name[0] != 0)
-            strcpy (buf2, caller_name);
-          else if (libmod_name[0] != 0)
-            strcpy (buf2, libmod_name);
-          else
-            strcpy (buf2, theadr_name);
           strcat (buf2, "!");
           if (omflib_add_pub (dst_lib, buf2, page, error) != 0)
             return -1;
         }
       if (dst_file != NULL
-          && omflib_pad (dst_file, dst_lib->page_size, FALSE, error) != 0)
+          && omflib_pad (dst_lib, dst_lib->page_size, FALSE, error) != 0)
         return -1;
     }
   return 0;
@@ -201,3 +236,159 @@ static int add_pubdef (const char *name, char *error)
 {
   return omflib_add_pub (pubdef_dst_lib, name, pubdef_page, error);
 }
+
+
+/* Copy the module at the current position of SRC_FILE to DST_LIB in
+   a single pass if it can be copied unchanged, that is, if no LIBMOD
+   comment record is to be removed or inserted.  LIBMOD is true if the
+   caller supplied the module name CALLER_NAME.  The records are read
+   directly into the output buffer of DST_LIB, each record body with
+   the header of the following record in one call of fread(); only the
+   records defining names are also copied to a local buffer for
+   parsing.
+   Return 1 if the module has been copied, storing the state of the
+   module to *PSTATE and the names found to THEADR_NAME and
+   LIBMOD_NAME.  Return 0 if the module must be copied record by
+   record; in that case, SRC_FILE is repositioned and the records and
+   public names added are removed again, including their copies in the
+   string arena.  Modules which don't fit into
+   the output buffer are also copied record by record, as are
+   defective modules, to get the error messages of the record-by-record
+   copy.  Return -1 on I/O error. */
+
+static int copy_block (struct omflib *dst_lib, FILE *src_file,
+                       const char *caller_name, int libmod, word page,
+                       enum omf_state *pstate, char *theadr_name,
+                       char *libmod_name, char *error)
+{
+  struct omf_rec rec;
+  struct str_mark mark;
+  byte buf[1024];
+  byte *dst;
+  long start;
+  int base, pub_count, last, len;
+  enum omf_state state;
+  enum rec_kind cur_rt, prev_rt;
+
+  start = ftell (src_file);
+  if (start == -1)
+    return 0;
+  base = dst_lib->out_len;
+  pub_count = dst_lib->pub_count;
+  omflib_str_mark (dst_lib, &mark);
+  pubdef_dst_lib = dst_lib;
+  pubdef_page = page;
+  state = OS_EMPTY; prev_rt = RT_OTHER;
+  if (fread (&rec, sizeof (rec), 1, src_file) != 1)
+    goto fallback;
+  do
+    {
+      /* MODEND is the last record of the module. */
+
+      last = (rec.rec_type == MODEND || rec.rec_type == (MODEND|REC32));
+      if (rec.rec_len > sizeof (buf))
+        goto fallback;
+      len = sizeof (rec) + rec.rec_len + (last ? 0 : sizeof (rec));
+      dst = dst_lib->out_buf + dst_lib->out_len;
+      if (dst_lib->out_len + len > OUT_BUF_SIZE)
+        {
+          /* Make room by writing the records preceding the module.
+             Give up if the module is too big for the buffer. */
+
+          if (base == 0)
+            goto fallback;
+          if (fwrite (dst_lib->out_buf, base, 1, dst_lib->f) != 1)
+            return omflib_set_error (error);
+          dst_lib->out_pos += base;
+          dst_lib->out_len -= base;
+          memmove (dst_lib->out_buf, dst_lib->out_buf + base,
+                   dst_lib->out_len);
+          base = 0;
+          if (dst_lib->out_len + len > OUT_BUF_SIZE)
+            goto fallback;
+          dst = dst_lib->out_buf + dst_lib->out_len;
+        }
+      memcpy (dst, &rec, sizeof (rec));
+      if (fread (dst + sizeof (rec), len - sizeof (rec), 1, src_file) != 1)
+        goto fallback;
+      dst_lib->out_len += sizeof (rec) + rec.rec_len;
+      cur_rt = RT_OTHER;
+      switch (rec.rec_type)
+        {
+        case THEADR:
+          memcpy (buf, dst + sizeof (rec), rec.rec_len);
+          if (rec.rec_len == 0 || buf[0] + 1 > rec.rec_len)
+            goto fallback;
+          buf[1+buf[0]] = 0;
+          omflib_module_name (theadr_name, (const char *)buf + 1);
+          state = OS_EMPTY; cur_rt = RT_THEADR;
+          break;
+
+        case PUBDEF:
+        case PUBDEF|REC32:
+          memcpy (buf, dst + sizeof (rec), rec.rec_len);
+          if (omflib_pubdef (&rec, buf, page, add_pubdef, error) != 0)
+            goto fallback;
+          state = OS_OTHER;
+          break;
+
+        case ALIAS:
+          memcpy (buf, dst + sizeof (rec), rec.rec_len);
+          if (omflib_alias (&rec, buf, page, add_pubdef, error) != 0)
+            goto fallback;
+          state = (state == OS_EMPTY ? OS_SIMPLE : OS_OTHER);
+          break;
+
+        case COMENT:
+          memcpy (buf, dst + sizeof (rec), rec.rec_len);
+          if (rec.rec_len >= 3 && buf[1] == IMPDEF_CLASS
+              && buf[2] == IMPDEF_SUBTYPE)
+            {
+              if (omflib_impdef (&rec, buf, page, add_pubdef, error) != 0)
+                goto fallback;
+              state = (state == OS_EMPTY ? OS_SIMPLE : OS_OTHER);
+            }
+          else if (rec.rec_len >= 2 && buf[1] == LIBMOD_CLASS)
+            {
+              if (libmod || rec.rec_len < 3 || buf[2] + 3 > rec.rec_len)
+                goto fallback;
+              buf[3+buf[2]] = 0;
+              omflib_module_name (libmod_name, (const char *)buf + 3);
+              state = OS_OTHER;
+            }
+          else
+            state = OS_OTHER;
+          break;
+
+        case MODEND:
+        case MODEND|REC32:
+          break;
+
+        default:
+          state = OS_OTHER;
+        }
+      if (prev_rt == RT_THEADR && libmod)
+        {
+          if (state == OS_SIMPLE)
+            cur_rt = RT_THEADR;
+          else if (strcmp (caller_name, theadr_name) != 0)
+            goto fallback;
+        }
+      prev_rt = cur_rt;
+      if (!last)
+        memcpy (&rec, dst + sizeof (rec) + rec.rec_len, sizeof (rec));
+    } while (!last);
+  if (dst_lib->out_len == OUT_BUF_SIZE && omflib_flush (dst_lib, error) != 0)
+    return -1;
+  *pstate = state;
+  return 1;
+
+fallback:
+  dst_lib->out_len = base;
+  dst_lib->pub_count = pub_count;
+  omflib_str_release (dst_lib, &mark);
+  theadr_name[0] = 0; libmod_name[0] = 0;
+  if (fseek (src_file, start, SEEK_SET) != 0)
+    return omflib_set_error (error);
+  return 0;
+}
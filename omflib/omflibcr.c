@@ -28,6 +28,15 @@ struct omflib *omflib_create (const char *fname, int page_size, char *error)
       return NULL;
     }
   p = malloc (sizeof (struct omflib));
+  if (p != NULL)
+    {
+      p->out_buf = malloc (OUT_BUF_SIZE);
+      if (p->out_buf == NULL)
+        {
+          free (p);
+          p = NULL;
+        }
+    }
   if (p == NULL)
     {
       errno = ENOMEM;
@@ -43,11 +52,19 @@ struct omflib *omflib_create (const char *fname, int page_size, char *error)
   p->flags = 1;
   p->mod_tab = NULL;
   p->mod_alloc = 0;
-  p->mod_count = -1;
+  p->mod_count = 0;
+  p->mod_hash = NULL;
+  p->mod_hash_size = 0;
   p->dict = NULL;
   p->pub_tab = NULL;
   p->pub_alloc = 0;
   p->pub_count = 0;
+  p->str_arena = NULL;
+  p->allocs = 0;
+  p->alloc_bytes = 0;
+  p->dict_retries = 0;
+  p->out_len = 0;
+  p->out_pos = 0;
   p->output = TRUE;
   p->state = OS_EMPTY;
   p->mod_page = 0;
@@ -58,29 +75,31 @@ struct omflib *omflib_create (const char *fname, int page_size, char *error)
 
 int omflib_header (struct omflib *p, char *error)
 {
+  if (omflib_flush (p, error) != 0)
+    return -1;
   fseek (p->f, 0, SEEK_SET);
-  return omflib_pad (p->f, p->page_size, TRUE, error);
+  p->out_pos = 0;
+  return omflib_pad (p, p->page_size, TRUE, error);
 }
 
 
-static int omflib_add_dict (struct omflib *p, const char *name, int page,
+static int omflib_add_dict (struct omflib *p, const struct pubsym *sym,
                             char *error)
 {
+  const char *name;
+  int page;
   int block_index, bucket_index;
   int bv, len, bucket_count;
   byte *block, *ptr;
   byte buf[257];
   int (*compare)(const void *s1, const void *s2, size_t n);
 
-  len = strlen (name);
-  if (len > 255)
-    {
-      strcpy (error, "Symbol name too long");
-      return -1;
-    }
+  name = sym->name;
+  page = sym->page;
+  len = sym->len;
   buf[0] = (byte)len;
   memcpy (buf+1, name, len);
-  omflib_hash (p, buf);
+  omflib_hash_set (p, &sym->hash);
   block_index = p->block_index;
   bucket_index = p->bucket_index;
   compare = (p->flags & 1 ? memcmp : memicmp);
@@ -156,7 +175,7 @@ static int omflib_build_dict (struct omflib *p, char *error)
     p->dict[i * 512 + 37] = 38 / 2;
   for (i = 0; i < p->pub_count; ++i)
     {
-      ret = omflib_add_dict (p, p->pub_tab[i].name, p->pub_tab[i].page, error);
+      ret = omflib_add_dict (p, &p->pub_tab[i], error);
       if (ret != 0)
         return ret;
     }
@@ -212,6 +231,80 @@ static unsigned next_prime (unsigned n)
 }
 
 
+/* Check whether the public symbols fit into a dictionary of
+   p->dict_blocks blocks.  This runs the placement of omflib_add_dict()
+   on the bucket occupancy and the fill level of each block only,
+   without copying names.  Return 1 if the dictionary overflows, 0 if
+   all symbols fit, -1 on error. */
+
+static int omflib_plan_dict (struct omflib *p, char *error)
+{
+  int i, block_index, bucket_index, bucket_count, len, ret;
+  byte *occ, *block;
+
+  occ = calloc (p->dict_blocks, 38);
+  if (occ == NULL)
+    {
+      errno = ENOMEM;
+      return omflib_set_error (error);
+    }
+  for (i = 0; i < p->dict_blocks; ++i)
+    occ[i * 38 + 37] = 38 / 2;
+  ret = 0;
+  for (i = 0; i < p->pub_count && ret == 0; ++i)
+    {
+      len = p->pub_tab[i].len;
+      omflib_hash_set (p, &p->pub_tab[i].hash);
+      block_index = p->block_index;
+      bucket_index = p->bucket_index;
+      bucket_count = 37;
+      block = occ + 38 * block_index;
+      for (;;)
+        {
+          if (!block[bucket_index])
+            {
+              if (block[37] == 0xff)
+                bucket_count = 0;
+              else if (2 * block[37] + len + 4 > 512)
+                {
+                  block[37] = 0xff;
+                  bucket_count = 0;
+                }
+              else
+                {
+                  block[bucket_index] = 1;
+                  block[37] = (2 * block[37] + len + 3 + 1) / 2;
+                  if (block[37] == 0) block[37] = 0xff;
+                  break;
+                }
+            }
+          if (bucket_count != 0)
+            {
+              bucket_index += p->bucket_index_delta;
+              if (bucket_index >= 37)
+                bucket_index -= 37;
+              --bucket_count;
+            }
+          if (bucket_count == 0)
+            {
+              block_index += p->block_index_delta;
+              if (block_index >= p->dict_blocks)
+                block_index -= p->dict_blocks;
+              if (block_index == p->block_index)
+                {
+                  ret = 1;
+                  break;
+                }
+              bucket_count = 37;
+              block = occ + 38 * block_index;
+            }
+        }
+    }
+  free (occ);
+  return ret;
+}
+
+
 int omflib_finish (struct omflib *p, char *error)
 {
   struct lib_header hdr;
@@ -224,11 +317,26 @@ int omflib_finish (struct omflib *p, char *error)
     return 0;
   len = 0;
   for (i = 0; i < p->pub_count; ++i)
-    len += strlen (p->pub_tab[i].name) + 3;
+    {
+      if (p->pub_tab[i].len > 255)
+        {
+          strcpy (error, "Symbol name too long");
+          return -1;
+        }
+      len += p->pub_tab[i].len + 3;
+    }
+
+  /* Choose the number of blocks by planning the placement, then build
+     the dictionary.  The planner makes the same decisions as
+     omflib_add_dict(), therefore each symbol is inserted only once
+     (unless the planner is fooled by a symbol defined twice).  The
+     hash values have been computed by omflib_add_pub(). */
+
   blocks = (len + 511) / 512;
   blocks += (blocks * 128) / 512;
   ++blocks;
   prime = blocks;
+  p->dict_retries = 0;
   for (;;)
     {
       prime = next_prime (prime);
@@ -238,25 +346,30 @@ int omflib_finish (struct omflib *p, char *error)
           return -1;
         }
       p->dict_blocks = prime;
-      i = omflib_build_dict (p, error);
+      i = omflib_plan_dict (p, error);
+      if (i == 0)
+        i = omflib_build_dict (p, error);
       if (i < 0)
         return i;
       if (i == 0)
         break;
+      ++p->dict_retries;
     }
-  pos = ftell (p->f) + 3;
+  pos = omflib_tell (p) + 3;
   rec.rec_type = LIBEND;
   if ((pos & 511) == 0)
     rec.rec_len = 0;
   else
     rec.rec_len = (word)(((pos | 511) + 1) - pos);
-  if (fwrite (&rec, sizeof (rec), 1, p->f) != 1)
-    return omflib_set_error (error);
-  if (omflib_pad (p->f, 512, FALSE, error) != 0)
+  if (omflib_write (p, &rec, sizeof (rec), error) != 0)
+    return -1;
+  if (omflib_pad (p, 512, FALSE, error) != 0)
     return -1;
   hdr.rec_type = LIBHDR;
   hdr.rec_len = p->page_size - 3;
-  hdr.dict_offset = ftell (p->f);
+  hdr.dict_offset = omflib_tell (p);
+  if (omflib_flush (p, error) != 0)
+    return -1;
   hdr.dict_blocks = p->dict_blocks;
   hdr.flags = (byte)p->flags;
   fseek (p->f, 0, SEEK_SET);
@@ -269,17 +382,77 @@ int omflib_finish (struct omflib *p, char *error)
 }
 
 
-int omflib_pad (FILE *f, int size, int force, char *error)
+/* Pad the output library with zeros to a multiple of SIZE bytes.  If
+   FORCE is true, add SIZE bytes if already aligned. */
+
+int omflib_pad (struct omflib *p, int size, int force, char *error)
 {
   long pos;
+  int n, len;
+
+  pos = omflib_tell (p);
+  if ((pos & (size-1)) != 0)
+    n = size - (int)(pos & (size-1));
+  else if (force)
+    n = size;
+  else
+    n = 0;
+  while (n > 0)
+    {
+      len = OUT_BUF_SIZE - p->out_len;
+      if (len > n)
+        len = n;
+      memset (p->out_buf + p->out_len, 0, len);
+      p->out_len += len;
+      n -= len;
+      if (p->out_len == OUT_BUF_SIZE && omflib_flush (p, error) != 0)
+        return -1;
+    }
+  return 0;
+}
+
 
-  pos = ftell (f);
-  while ((pos & (size-1)) != 0 || force)
+/* Return the current position in the output library, including
+   buffered data. */
+
+long omflib_tell (struct omflib *p)
+{
+  return p->out_pos + p->out_len;
+}
+
+
+/* Append LEN bytes at SRC to the output buffer.  The buffer is written
+   when full, therefore all writes but the last one are aligned to
+   OUT_BUF_SIZE bytes. */
+
+int omflib_write (struct omflib *p, const void *src, int len, char *error)
+{
+  int n;
+
+  while (len > 0)
+    {
+      n = OUT_BUF_SIZE - p->out_len;
+      if (n > len)
+        n = len;
+      memcpy (p->out_buf + p->out_len, src, n);
+      p->out_len += n;
+      src = (const byte *)src + n;
+      len -= n;
+      if (p->out_len == OUT_BUF_SIZE && omflib_flush (p, error) != 0)
+        return -1;
+    }
+  return 0;
+}
+
+
+int omflib_flush (struct omflib *p, char *error)
+{
+  if (p->out_len != 0)
     {
-      force = FALSE;
-      if (fputc (0, f) != 0)
+      if (fwrite (p->out_buf, p->out_len, 1, p->f) != 1)
         return omflib_set_error (error);
-      ++pos;
+      p->out_pos += p->out_len;
+      p->out_len = 0;
     }
   return 0;
 }
@@ -5,27 +5,118 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
 #include "omflib0.h"
 #include <sys/omflib.h>
 
 
+/* Compute the hash code of the module name S.  Letter case is ignored
+   unless module names are case sensitive in P. */
+
+static unsigned mod_hash (const struct omflib *p, const char *s)
+{
+  unsigned h;
+
+  h = 0;
+  if (p->flags & 1)
+    while (*s != 0)
+      h = h * 33 + (unsigned char)*s++;
+  else
+    while (*s != 0)
+      h = h * 33 + tolower ((unsigned char)*s++);
+  return h;
+}
+
+
+/* Build the hash table of module names of P, which maps names to
+   indices of mod_tab.  If there are modules of the same name, the
+   first one is entered, as it would be found by a linear search. */
+
+static int make_mod_hash (struct omflib *p, char *error)
+{
+  int (*compare)(const char *s1, const char *s2);
+  int i, j, size;
+  int *tab;
+
+  size = 64;
+  while (size < 2 * p->mod_count)
+    size *= 2;
+  tab = calloc (size, sizeof (*tab));
+  if (tab == NULL)
+    {
+      errno = ENOMEM;
+      return omflib_set_error (error);
+    }
+  compare = (p->flags & 1 ? strcmp : stricmp);
+  for (i = 0; i < p->mod_count; ++i)
+    {
+      j = mod_hash (p, p->mod_tab[i].name) & (size - 1);
+      while (tab[j] != 0
+             && compare (p->mod_tab[tab[j]-1].name, p->mod_tab[i].name) != 0)
+        j = (j + 1) & (size - 1);
+      if (tab[j] == 0)
+        tab[j] = i + 1;
+    }
+  p->mod_hash = tab;
+  p->mod_hash_size = size;
+  return 0;
+}
+
+
+/* Mark the module NAME of P as deleted.  Return FALSE if there is no
+   such module. */
+
+static int mark_deleted (struct omflib *p, const char *name)
+{
+  int (*compare)(const char *s1, const char *s2);
+  int i, j;
+
+  compare = (p->flags & 1 ? strcmp : stricmp);
+  j = mod_hash (p, name) & (p->mod_hash_size - 1);
+  while ((i = p->mod_hash[j]) != 0)
+    {
+      if (compare (p->mod_tab[i-1].name, name) == 0)
+        {
+          p->mod_tab[i-1].flags |= FLAG_DELETED;
+          return TRUE;
+        }
+      j = (j + 1) & (p->mod_hash_size - 1);
+    }
+  return FALSE;
+}
+
+
 int omflib_mark_deleted (struct omflib *p, const char *name, char *error)
+{
+  return omflib_mark_deleted_list (p, &name, 1, error);
+}
+
+
+/* Mark the N modules of NAMES as deleted.  If any of the modules does
+   not exist, store a message naming the first missing module to ERROR
+   and return 0 anyway. */
+
+int omflib_mark_deleted_list (struct omflib *p, const char * const *names,
+                              int n, char *error)
 {
   char buf[256];
-  int (*compare)(const char *s1, const char *s2);
-  int i;
+  int i, missing;
 
   if (p->mod_count == -1 && omflib_make_mod_tab (p, error) != 0)
     return -1;
-  omflib_module_name (buf, name);
-  compare = (p->flags & 1 ? strcmp : stricmp);
-  for (i = 0; i < p->mod_count; ++i)
-    if (compare (p->mod_tab[i].name, buf) == 0)
-      {
-        p->mod_tab[i].flags |= FLAG_DELETED;
-        return 0;
-      }
-  strcpy (error, "Module not found: ");
-  strcat (error, buf);
+  if (p->mod_hash == NULL && make_mod_hash (p, error) != 0)
+    return -1;
+  missing = FALSE;
+  for (i = 0; i < n; ++i)
+    {
+      omflib_module_name (buf, names[i]);
+      if (!mark_deleted (p, buf) && !missing)
+        {
+          strcpy (error, "Module not found: ");
+          strcat (error, buf);
+          missing = TRUE;
+        }
+    }
   return 0;
 }
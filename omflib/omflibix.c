@@ -0,0 +1,458 @@
+/* omflibix.c (emx+gcc) */
+
+/* Write and read the symbol index of an OMFLIB.
+
+   The symbol index is a file kept next to a library.  It lists the
+   public symbols and the modules of the library together with the
+   page numbers of the modules, sorted by name.  The file is used in
+   place after being mapped (or read) into memory, so that lookups by
+   name or name prefix can be done without opening the library. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "omflib0.h"
+#include <sys/omflib.h>
+
+#if defined (__unix__) || defined (__APPLE__)
+#include <unistd.h>
+#endif
+
+#if defined (_POSIX_MAPPED_FILES) && _POSIX_MAPPED_FILES > 0
+#define USE_MMAP
+#include <sys/mman.h>
+#endif
+
+#define IDX_MAGIC   "omfidx\x1a"
+#define IDX_FORMAT  2
+
+#pragma pack(1)
+
+struct idx_header
+{
+  char magic[8];
+  dword format;
+  dword lib_size;               /* Size of the library */
+  dword lib_mtime[2];           /* Modification time of the library */
+  dword page_size;
+  dword flags;                  /* Flags of the library (1: case matters) */
+  dword count[2];               /* Number of symbols and modules */
+  dword offset[2];              /* File offsets of the tables */
+  dword str_offset;             /* File offset of the strings */
+  dword str_size;
+};
+
+struct idx_entry
+{
+  dword name;                   /* Offset into the strings */
+  word len;
+  word page;
+};
+
+#pragma pack()
+
+struct omfidx
+{
+  const byte *data;
+  long size;
+  int mapped;
+  const struct idx_header *hdr;
+  const struct idx_entry *tab[2];
+  int count[2];
+  const char *str;
+};
+
+/* A name of the library being written. */
+
+struct idx_name
+{
+  const char *name;
+  int len;
+  word page;
+};
+
+/* Sort order of the names of the library being written. */
+
+static int (*sort_compare)(const char *s1, const char *s2);
+
+
+static int compare_name_page (const void *x1, const void *x2)
+{
+  const struct idx_name *n1 = x1;
+  const struct idx_name *n2 = x2;
+  int r;
+
+  r = sort_compare (n1->name, n2->name);
+  if (r == 0)
+    r = (int)n1->page - (int)n2->page;
+  return r;
+}
+
+
+/* Write the symbol index of the output library P to the file FNAME.
+   Call this function after omflib_finish().  The names of the modules
+   are not included in the symbol table, as they are listed in the
+   module table. */
+
+int omflib_write_index (struct omflib *p, const char *fname, char *error)
+{
+  struct idx_header hdr;
+  struct idx_entry e;
+  struct idx_name *tab;
+  struct stat st;
+  FILE *f;
+  int i, n, ret;
+
+  if (!p->output)
+    {
+      strcpy (error, "Not implemented for input library");
+      return -1;
+    }
+  if (omflib_flush (p, error) != 0)
+    return -1;
+  tab = malloc ((p->pub_count + p->mod_count + 1) * sizeof (*tab));
+  if (tab == NULL)
+    {
+      errno = ENOMEM;
+      return omflib_set_error (error);
+    }
+
+  /* The symbols come first in TAB, followed by the modules. */
+
+  n = 0;
+  for (i = 0; i < p->pub_count; ++i)
+    {
+      tab[n].name = p->pub_tab[i].name;
+      tab[n].len = strlen (tab[n].name);
+      tab[n].page = p->pub_tab[i].page;
+      if (tab[n].len == 0 || tab[n].name[tab[n].len-1] != '!')
+        ++n;
+    }
+  hdr.count[0] = n;
+  for (i = 0; i < p->mod_count; ++i, ++n)
+    {
+      tab[n].name = p->mod_tab[i].name;
+      tab[n].len = strlen (tab[n].name);
+      tab[n].page = p->mod_tab[i].page;
+    }
+  hdr.count[1] = p->mod_count;
+  sort_compare = (p->flags & 1 ? strcmp : stricmp);
+  qsort (tab, hdr.count[0], sizeof (*tab), compare_name_page);
+  qsort (tab + hdr.count[0], hdr.count[1], sizeof (*tab), compare_name_page);
+
+  /* Flush the library to get its final size and modification time;
+     omflib_close() won't write anything after this. */
+
+  if (fflush (p->f) != 0 || fstat (fileno (p->f), &st) != 0)
+    {
+      free (tab);
+      return omflib_set_error (error);
+    }
+  memcpy (hdr.magic, IDX_MAGIC, sizeof (hdr.magic));
+  hdr.format = IDX_FORMAT;
+  hdr.lib_size = st.st_size;
+  hdr.lib_mtime[0] = (dword)st.st_mtime;
+  hdr.lib_mtime[1] = (dword)((st.st_mtime >> 16) >> 16);
+  hdr.page_size = p->page_size;
+  hdr.flags = p->flags;
+  hdr.offset[0] = sizeof (hdr);
+  hdr.offset[1] = hdr.offset[0] + hdr.count[0] * sizeof (struct idx_entry);
+  hdr.str_offset = hdr.offset[1] + hdr.count[1] * sizeof (struct idx_entry);
+  hdr.str_size = 0;
+  for (i = 0; i < n; ++i)
+    hdr.str_size += tab[i].len + 1;
+
+  f = fopen (fname, "wb");
+  if (f == NULL)
+    {
+      free (tab);
+      return omflib_set_error (error);
+    }
+  ret = 0;
+  if (fwrite (&hdr, sizeof (hdr), 1, f) != 1)
+    ret = -1;
+  e.name = 0;
+  for (i = 0; ret == 0 && i < n; ++i)
+    {
+      e.len = tab[i].len;
+      e.page = tab[i].page;
+      if (fwrite (&e, sizeof (e), 1, f) != 1)
+        ret = -1;
+      e.name += tab[i].len + 1;
+    }
+  for (i = 0; ret == 0 && i < n; ++i)
+    if (fwrite (tab[i].name, tab[i].len + 1, 1, f) != 1)
+      ret = -1;
+  if (fflush (f) != 0)
+    ret = -1;
+  if (ret != 0)
+    omflib_set_error (error);
+  fclose (f);
+  if (ret != 0)
+    remove (fname);
+  free (tab);
+  return ret;
+}
+
+
+static int bad_index (struct omfidx *x, char *error)
+{
+  strcpy (error, "Invalid symbol index");
+  omflib_index_close (x);
+  return -1;
+}
+
+
+/* Check the tables of the symbol index X.  Return 0 if they are
+   consistent. */
+
+static int check_index (struct omfidx *x, char *error)
+{
+  const struct idx_header *hdr;
+  const struct idx_entry *e;
+  int i, n;
+
+  if (x->size < (long)sizeof (struct idx_header))
+    return bad_index (x, error);
+  hdr = (const struct idx_header *)x->data;
+  if (memcmp (hdr->magic, IDX_MAGIC, sizeof (hdr->magic)) != 0
+      || hdr->format != IDX_FORMAT
+      || hdr->str_offset > x->size
+      || hdr->str_size != x->size - hdr->str_offset)
+    return bad_index (x, error);
+  x->hdr = hdr;
+  x->str = (const char *)x->data + hdr->str_offset;
+  for (n = 0; n < 2; ++n)
+    {
+      if (hdr->count[n] > (dword)(x->size / sizeof (struct idx_entry))
+          || hdr->offset[n] > hdr->str_offset
+          || (hdr->str_offset - hdr->offset[n]) / sizeof (struct idx_entry)
+             < hdr->count[n])
+        return bad_index (x, error);
+      x->tab[n] = (const struct idx_entry *)(x->data + hdr->offset[n]);
+      x->count[n] = (int)hdr->count[n];
+      for (i = 0, e = x->tab[n]; i < x->count[n]; ++i, ++e)
+        if (e->name >= hdr->str_size || e->len >= hdr->str_size - e->name
+            || x->str[e->name + e->len] != 0)
+          return bad_index (x, error);
+    }
+  return 0;
+}
+
+
+/* Open the symbol index FNAME.  The file is mapped into memory if
+   possible.  Return NULL on error. */
+
+struct omfidx *omflib_index_open (const char *fname, char *error)
+{
+  struct omfidx *x;
+  FILE *f;
+  byte *buf;
+
+  f = fopen (fname, "rb");
+  if (f == NULL)
+    {
+      omflib_set_error (error);
+      return NULL;
+    }
+  x = malloc (sizeof (struct omfidx));
+  if (x == NULL)
+    {
+      errno = ENOMEM;
+      omflib_set_error (error);
+      fclose (f);
+      return NULL;
+    }
+  x->data = NULL; x->mapped = FALSE;
+  fseek (f, 0, SEEK_END);
+  x->size = ftell (f);
+  if (x->size <= 0)
+    {
+      fclose (f);
+      bad_index (x, error);
+      return NULL;
+    }
+#if defined (USE_MMAP)
+  buf = mmap (NULL, (size_t)x->size, PROT_READ, MAP_PRIVATE, fileno (f), 0);
+  if (buf != MAP_FAILED)
+    {
+      x->data = buf;
+      x->mapped = TRUE;
+    }
+#endif
+  if (x->data == NULL)
+    {
+      buf = malloc (x->size);
+      if (buf == NULL)
+        errno = ENOMEM;
+      else if (fseek (f, 0, SEEK_SET) != 0
+               || fread (buf, x->size, 1, f) != 1)
+        {
+          if (!ferror (f))
+            errno = EINVAL;
+          free (buf);
+          buf = NULL;
+        }
+      if (buf == NULL)
+        {
+          omflib_set_error (error);
+          fclose (f);
+          free (x);
+          return NULL;
+        }
+      x->data = buf;
+    }
+  fclose (f);
+  if (check_index (x, error) != 0)
+    return NULL;
+  return x;
+}
+
+
+int omflib_index_close (struct omfidx *x)
+{
+#if defined (USE_MMAP)
+  if (x->mapped)
+    munmap ((void *)x->data, (size_t)x->size);
+  else
+#endif
+    free ((void *)x->data);
+  free (x);
+  return 0;
+}
+
+
+/* Check whether the symbol index X is up to date with respect to the
+   library LIB_FNAME.  The size and the modification time of the
+   library are compared, the library is not read.  Return 0 if the index matches. */
+
+int omflib_index_check (struct omfidx *x, const char *lib_fname,
+                        char *error)
+{
+  struct stat st;
+
+  if (stat (lib_fname, &st) != 0)
+    return omflib_set_error (error);
+  if ((dword)st.st_size != x->hdr->lib_size
+      || (dword)st.st_mtime != x->hdr->lib_mtime[0]
+      || (dword)((st.st_mtime >> 16) >> 16) != x->hdr->lib_mtime[1])
+    {
+      strcpy (error, "Symbol index out of date");
+      return -1;
+    }
+  return 0;
+}
+
+
+/* Compare the first LEN characters of NAME with entry E of the symbol
+   index X.  If PREFIX is true, E matches if it starts with NAME. */
+
+static int compare_name (const struct omfidx *x, const struct idx_entry *e,
+                         const char *name, int len, int prefix)
+{
+  int r;
+
+  if (x->hdr->flags & 1)
+    r = memcmp (x->str + e->name, name, (len < e->len ? len : e->len));
+  else
+    r = memicmp (x->str + e->name, name, (len < e->len ? len : e->len));
+  if (r != 0)
+    return r;
+  if (e->len < len)
+    return -1;
+  if (e->len > len && !prefix)
+    return 1;
+  return 0;
+}
+
+
+/* Search table TABLE (OMFIDX_SYMBOLS or OMFIDX_MODULES) of the symbol
+   index X for the names starting with PREFIX.  Store the number of
+   matching entries to *COUNT and return the index of the first one.
+   If there is no match, the return value is the index at which
+   PREFIX would be inserted. */
+
+int omflib_index_search (struct omfidx *x, int table, const char *prefix,
+                         int *count)
+{
+  const struct idx_entry *tab;
+  int lo, hi, mid, first, len;
+
+  tab = x->tab[table];
+  len = strlen (prefix);
+  lo = 0; hi = x->count[table];
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (compare_name (x, &tab[mid], prefix, len, TRUE) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  first = lo;
+  hi = x->count[table];
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (compare_name (x, &tab[mid], prefix, len, TRUE) <= 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  *count = lo - first;
+  return first;
+}
+
+
+/* Return the page number of the module defining the symbol NAME (or
+   of the module NAME if TABLE is OMFIDX_MODULES), or 0 if the name is
+   not in the symbol index X. */
+
+int omflib_index_find (struct omfidx *x, int table, const char *name)
+{
+  const struct idx_entry *tab;
+  int lo, hi, mid, len, r;
+
+  tab = x->tab[table];
+  len = strlen (name);
+  lo = 0; hi = x->count[table];
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      r = compare_name (x, &tab[mid], name, len, FALSE);
+      if (r < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if (lo < x->count[table]
+      && compare_name (x, &tab[lo], name, len, FALSE) == 0)
+    return tab[lo].page;
+  return 0;
+}
+
+
+/* Return the number of entries of table TABLE of the symbol index X. */
+
+int omflib_index_count (struct omfidx *x, int table)
+{
+  return x->count[table];
+}
+
+
+/* Store the name and the page number of entry N of table TABLE of the
+   symbol index X to *NAME and *PAGE.  Return -1 if there is no such
+   entry. */
+
+int omflib_index_entry (struct omfidx *x, int table, int n,
+                        const char **name, int *page)
+{
+  if (n < 0 || n >= x->count[table])
+    return -1;
+  *name = x->str + x->tab[table][n].name;
+  *page = x->tab[table][n].page;
+  return 0;
+}
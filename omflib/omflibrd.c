@@ -47,10 +47,19 @@ struct omflib *omflib_open (const char *fname, char *error)
   p->mod_tab = NULL;
   p->mod_alloc = 0;
   p->mod_count = -1;
+  p->mod_hash = NULL;
+  p->mod_hash_size = 0;
   p->dict = NULL;
   p->pub_tab = NULL;
   p->pub_alloc = 0;
   p->pub_count = 0;
+  p->str_arena = NULL;
+  p->allocs = 0;
+  p->alloc_bytes = 0;
+  p->dict_retries = 0;
+  p->out_buf = NULL;
+  p->out_len = 0;
+  p->out_pos = 0;
   p->output = FALSE;
   p->state = OS_EMPTY;
   p->mod_page = 0;
@@ -93,31 +102,67 @@ int omflib_read_dictionary (struct omflib *p, char *error)
 }
 
 
-static int mod_compare (const void *x1, const void *x2)
+/* Sort the N modules of SRC by page number, using TMP (which has room
+   for N modules) for the intermediate result.  This is a radix sort
+   on the two bytes of the page number; it is stable. */
+
+static void sort_mod_tab (struct omfmod *src, struct omfmod *tmp, int n)
 {
-  word page1, page2;
+  int count[256];
+  int i, shift, pos, c;
+  struct omfmod *from, *to, *t;
 
-  page1 = ((const struct omfmod *)x1)->page;
-  page2 = ((const struct omfmod *)x2)->page;
-  if (page1 < page2)
-    return -1;
-  else if (page1 > page2)
-    return 1;
-  else
-    return 0;
+  from = src; to = tmp;
+  for (shift = 0; shift < 16; shift += 8)
+    {
+      memset (count, 0, sizeof (count));
+      for (i = 0; i < n; ++i)
+        ++count[(from[i].page >> shift) & 0xff];
+      pos = 0;
+      for (i = 0; i < 256; ++i)
+        {
+          c = count[i]; count[i] = pos; pos += c;
+        }
+      for (i = 0; i < n; ++i)
+        to[count[(from[i].page >> shift) & 0xff]++] = from[i];
+      t = from; from = to; to = t;
+    }
 }
 
 
+/* Build the table of modules from the dictionary.  A dictionary block
+   holds at most 37 names, so the table is allocated once for the
+   maximum number of modules.  The module names are copied to the
+   string arena. */
+
 int omflib_make_mod_tab (struct omflib *p, char *error)
 {
-  int block, bucket, bv, len;
-  char string[256];
-  struct omfmod *mod;
+  int block, bucket, bv, len, max;
+  struct omfmod *mod, *tmp;
   byte *d, *s;
 
   if (p->dict == NULL && omflib_read_dictionary (p, error) != 0)
     return -1;
+  if (p->mod_tab != NULL)
+    free (p->mod_tab);
+  if (p->mod_hash != NULL)
+    free (p->mod_hash);
+  p->mod_hash = NULL;
+  p->mod_hash_size = 0;
+  p->mod_count = -1;
+  p->mod_alloc = 0;
+  max = p->dict_blocks * 37;
+  p->mod_tab = malloc ((max != 0 ? max : 1) * sizeof (struct omfmod));
+  if (p->mod_tab == NULL)
+    {
+      errno = ENOMEM;
+      return omflib_set_error (error);
+    }
+  ++p->allocs;
+  p->alloc_bytes += max * sizeof (struct omfmod);
+  p->mod_alloc = max;
   p->mod_count = 0;
+  mod = p->mod_tab;
   d = p->dict;
   for (block = 0; block < p->dict_blocks; ++block, d += 512)
     for (bucket = 0; bucket < 37; ++bucket)
@@ -129,35 +174,31 @@ int omflib_make_mod_tab (struct omflib *p, char *error)
             len = *s;
             if (s[len] == '!')
               {
-                memcpy (string, s+1, len-1);
-                string[len-1] = 0;
-                if (p->mod_count >= p->mod_alloc)
-                  {
-                    p->mod_alloc += 16;
-                    p->mod_tab = realloc (p->mod_tab, p->mod_alloc
-                                          * sizeof (struct omfmod));
-                    if (p->mod_tab == NULL)
-                      {
-                        p->mod_count = -1;
-                        p->mod_alloc = 0;
-                        errno = ENOMEM;
-                        return omflib_set_error (error);
-                      }
-                  }
-                mod = &p->mod_tab[p->mod_count];
                 mod->page = s[len+1] | (s[len+2] << 8);
-                mod->name = strdup (string);
+                mod->name = omflib_str_copy (p, (const char *)s + 1,
+                                             len - 1);
                 mod->flags = 0;
                 if (mod->name == NULL)
                   {
-                    errno = ENOMEM;
+                    p->mod_count = -1;
                     return omflib_set_error (error);
                   }
-                ++p->mod_count;
+                ++mod; ++p->mod_count;
               }
           }
       }
-  qsort (p->mod_tab, p->mod_count, sizeof (p->mod_tab[0]), mod_compare);
+  if (p->mod_count > 1)
+    {
+      tmp = malloc (p->mod_count * sizeof (struct omfmod));
+      if (tmp == NULL)
+        {
+          p->mod_count = -1;
+          errno = ENOMEM;
+          return omflib_set_error (error);
+        }
+      sort_mod_tab (p->mod_tab, tmp, p->mod_count);
+      free (tmp);
+    }
   return 0;
 }
 
@@ -186,43 +227,45 @@ int omflib_module_info (struct omflib *p, int n, char *name, int *page,
 }
 
 
-int omflib_find_symbol (struct omflib *p, const char *name, char *error)
+/* Look up the symbol BUF (a length-prefixed string) whose raw hash
+   values are H in the dictionary.  Return the page number or 0 if the
+   symbol is not defined.  If PROBES is not NULL, store the number of
+   buckets examined to *PROBES. */
+
+int omflib_probe (struct omflib *p, const byte *buf, const struct omfhash *h,
+                  int *probes)
 {
   int block_index, bucket_index;
-  int bv, len, bucket_count;
-  byte *ptr, *block, buf[257];
+  int bv, len, bucket_count, count, page;
+  const byte *ptr, *block;
   int (*compare)(const void *s1, const void *s2, size_t n);
 
-  if (p->dict == NULL && omflib_read_dictionary (p, error) != 0)
-    return -1;
-  len = strlen (name);
-  if (len > 255)
-    {
-      strcpy (error, "Symbol name too long");
-      return -1;
-    }
-  buf[0] = (byte)len;
-  memcpy (buf+1, name, len);
-  omflib_hash (p, buf);
+  len = buf[0];
+  omflib_hash_set (p, h);
   block_index = p->block_index;
   bucket_index = p->bucket_index;
   bucket_count = 37;
   compare = (p->flags & 1 ? memcmp : memicmp);
+  count = 0; page = 0;
   for (;;)
     {
       block = p->dict + 512 * block_index;
       bv = block[bucket_index];
+      ++count;
       if (bv == 0)
         {
           if (block[37] != 0xff)
-            return 0;
+            break;
           bucket_count = 0;     /* Keep bucket_index! */
         }
       else
         {
           ptr = block + 2 * bv;
           if (*ptr == len && compare (ptr+1, buf+1, len) == 0)
-            return ptr[len+1] + (ptr[len+2] << 8);
+            {
+              page = ptr[len+1] + (ptr[len+2] << 8);
+              break;
+            }
           bucket_index += p->bucket_index_delta;
           if (bucket_index >= 37)
             bucket_index -= 37;
@@ -234,10 +277,152 @@ int omflib_find_symbol (struct omflib *p, const char *name, char *error)
           if (block_index >= p->dict_blocks)
             block_index -= p->dict_blocks;
           if (block_index == p->block_index)
-            return 0;
+            break;
           bucket_count = 37;
         }
     }
+  if (probes != NULL)
+    *probes = count;
+  return page;
+}
+
+
+int omflib_find_symbol (struct omflib *p, const char *name, char *error)
+{
+  int len;
+  byte buf[257];
+  struct omfhash h;
+
+  if (p->dict == NULL && omflib_read_dictionary (p, error) != 0)
+    return -1;
+  len = strlen (name);
+  if (len > 255)
+    {
+      strcpy (error, "Symbol name too long");
+      return -1;
+    }
+  buf[0] = (byte)len;
+  memcpy (buf+1, name, len);
+  omflib_hash_raw (buf, &h);
+  return omflib_probe (p, buf, &h, NULL);
+}
+
+
+/* Collect statistics about the dictionary of P in *ST.  For an output
+   library, call this function after omflib_finish(). */
+
+int omflib_dict_stats (struct omflib *p, struct omflib_dict_stats *st,
+                       char *error)
+{
+  int i, j, bv, used, probes;
+  const byte *block, *ptr;
+  byte buf[257];
+  struct omfhash h;
+
+  if (p->dict == NULL)
+    {
+      if (p->output)
+        {
+          strcpy (error, "Dictionary not built");
+          return -1;
+        }
+      if (omflib_read_dictionary (p, error) != 0)
+        return -1;
+    }
+  memset (st, 0, sizeof (*st));
+  st->blocks = p->dict_blocks;
+  st->retries = p->dict_retries;
+  for (i = 0; i < p->dict_blocks; ++i)
+    {
+      block = p->dict + 512 * i;
+      if (block[37] == 0xff)
+        ++st->full_blocks;
+
+      /* Each entry is aligned to a word. */
+
+      used = 38;
+      for (j = 0; j < 37; ++j)
+        {
+          bv = block[j];
+          if (bv == 0)
+            continue;
+          ptr = block + 2 * bv;
+          used += (ptr[0] + 3 + 1) & ~1;
+          memcpy (buf, ptr, ptr[0] + 1);
+          omflib_hash_raw (buf, &h);
+          omflib_probe (p, buf, &h, &probes);
+          ++st->symbols;
+          st->probe_sum += probes;
+          if (probes > st->probe_max)
+            st->probe_max = probes;
+        }
+      if (used > 512)
+        used = 512;
+      st->wasted_bytes += 512 - used;
+      ++st->fill_hist[(used - 1) / (512 / OMFLIB_FILL_BINS)];
+    }
+  return 0;
+}
+
+
+/* Look up the N symbols NAMES in the dictionary, storing the page
+   numbers of the modules defining them to PAGES (0 for symbols not
+   found).  All the names are hashed first and then looked up in the
+   order of their first dictionary blocks, to visit the blocks one
+   after the other. */
+
+int omflib_find_symbols (struct omflib *p, const char * const *names,
+                         int n, int *pages, char *error)
+{
+  struct omfhash *hash;
+  int *count, *order;
+  int i, j, len;
+  byte buf[257];
+
+  if (p->dict == NULL && omflib_read_dictionary (p, error) != 0)
+    return -1;
+  hash = malloc ((n != 0 ? n : 1) * sizeof (struct omfhash));
+  order = malloc ((n != 0 ? n : 1) * sizeof (int));
+  count = malloc ((p->dict_blocks + 1) * sizeof (int));
+  if (hash == NULL || order == NULL || count == NULL)
+    {
+      free (hash); free (order); free (count);
+      errno = ENOMEM;
+      return omflib_set_error (error);
+    }
+
+  /* Hash the names and sort them by first block (counting sort). */
+
+  memset (count, 0, (p->dict_blocks + 1) * sizeof (int));
+  for (i = 0; i < n; ++i)
+    {
+      len = strlen (names[i]);
+      if (len > 255)
+        {
+          free (hash); free (order); free (count);
+          strcpy (error, "Symbol name too long");
+          return -1;
+        }
+      buf[0] = (byte)len;
+      memcpy (buf+1, names[i], len);
+      omflib_hash_raw (buf, &hash[i]);
+      ++count[hash[i].block_index % p->dict_blocks + 1];
+    }
+  for (i = 0; i < p->dict_blocks; ++i)
+    count[i+1] += count[i];
+  for (i = 0; i < n; ++i)
+    order[count[hash[i].block_index % p->dict_blocks]++] = i;
+
+  for (i = 0; i < n; ++i)
+    {
+      j = order[i];
+      len = strlen (names[j]);
+      buf[0] = (byte)len;
+      memcpy (buf+1, names[j], len);
+      pages[j] = omflib_probe (p, buf, &hash[j], NULL);
+    }
+  free (hash); free (order); free (count);
+  return 0;
 }
 
 
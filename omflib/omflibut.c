@@ -5,9 +5,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include "omflib0.h"
 #include <sys/omflib.h>
 
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#endif
+
 int omflib_set_error (char *error)
 {
   strcpy (error, strerror (errno));
@@ -15,34 +20,131 @@ int omflib_set_error (char *error)
 }
 
 
+/* Return the number of times omflib_finish() had to choose a bigger
+   dictionary.  The retries are counted while planning the placement of
+   the symbols; the dictionary itself is written only once, for the
+   final size. */
+
+int omflib_dict_retries (struct omflib *p)
+{
+  return p->dict_retries;
+}
+
+
+/* Return the number of tables and string arena blocks allocated for
+   P.  Store the total number of bytes requested by these allocations
+   to *BYTES unless BYTES is NULL. */
+
+int omflib_alloc_count (struct omflib *p, long *bytes)
+{
+  if (bytes != NULL)
+    *bytes = p->alloc_bytes;
+  return p->allocs;
+}
+
+
+/* Copy the string S of LEN characters to the string arena of P and
+   return a pointer to the copy.  Return NULL if out of memory. */
+
+char *omflib_str_copy (struct omflib *p, const char *s, int len)
+{
+  struct str_block *b;
+  char *d;
+  int size;
+
+  b = p->str_arena;
+  if (b == NULL || b->used + len + 1 > b->size)
+    {
+      size = (len + 1 > STR_BLOCK_SIZE ? len + 1 : STR_BLOCK_SIZE);
+      b = malloc (sizeof (struct str_block) + size);
+      if (b == NULL)
+        {
+          errno = ENOMEM;
+          return NULL;
+        }
+      b->size = size;
+      b->used = 0;
+      b->next = p->str_arena;
+      p->str_arena = b;
+      ++p->allocs;
+      p->alloc_bytes += sizeof (struct str_block) + size;
+    }
+  d = b->data + b->used;
+  memcpy (d, s, len);
+  d[len] = 0;
+  b->used += len + 1;
+  return d;
+}
+
+
+/* Store the fill level of the string arena of P to *MARK. */
+
+void omflib_str_mark (struct omflib *p, struct str_mark *mark)
+{
+  mark->block = p->str_arena;
+  mark->used = (p->str_arena != NULL ? p->str_arena->used : 0);
+}
+
+
+/* Remove the strings copied to the string arena of P since
+   omflib_str_mark() stored *MARK. */
+
+void omflib_str_release (struct omflib *p, const struct str_mark *mark)
+{
+  struct str_block *b;
+
+  while (p->str_arena != mark->block)
+    {
+      b = p->str_arena;
+      p->str_arena = b->next;
+      --p->allocs;
+      p->alloc_bytes -= sizeof (struct str_block) + b->size;
+      free (b);
+    }
+  if (p->str_arena != NULL)
+    p->str_arena->used = mark->used;
+}
+
+
 int omflib_close (struct omflib *p, char *error)
 {
-  int i;
+  struct str_block *b;
+  int ret;
 
+  ret = 0;
+  if (p->out_buf != NULL)
+    {
+      if (omflib_flush (p, error) != 0)
+        ret = -1;
+      free (p->out_buf);
+    }
   fclose (p->f);
   if (p->dict != NULL)
     free (p->dict);
   if (p->mod_tab != NULL)
-    {
-      for (i = 0; i < p->mod_count; ++i)
-        free (p->mod_tab[i].name);
-      free (p->mod_tab);
-    }
+    free (p->mod_tab);
+  if (p->mod_hash != NULL)
+    free (p->mod_hash);
   if (p->pub_tab != NULL)
+    free (p->pub_tab);
+  while (p->str_arena != NULL)
     {
-      for (i = 0; i < p->pub_count; ++i)
-        free (p->pub_tab[i].name);
-      free (p->pub_tab);
+      b = p->str_arena;
+      p->str_arena = b->next;
+      free (b);
     }
   free (p);
-  return 0;
+  return ret;
 }
 
 
 #define ROL2(x) (((unsigned)(x) << 2) | ((unsigned)(x) >> 14))
 #define ROR2(x) (((unsigned)(x) >> 2) | ((unsigned)(x) << 14))
 
-void omflib_hash (struct omflib *p, const byte *name)
+/* Compute the raw hash values of the symbol NAME, which is a
+   length-prefixed string. */
+
+void omflib_hash_raw (const byte *name, struct omfhash *h)
 {
   int i, len;
   word block_index, bucket_index, block_index_delta, bucket_index_delta;
@@ -62,17 +164,76 @@ void omflib_hash (struct omflib *p, const byte *name)
       bucket_index = ROR2 (bucket_index) ^ c;
       block_index_delta = ROL2 (block_index_delta) ^ c;
     }
-  p->block_index = block_index % p->dict_blocks;
-  p->block_index_delta = block_index_delta % p->dict_blocks;
+  h->block_index = block_index;
+  h->block_index_delta = block_index_delta;
+  h->bucket_index = bucket_index;
+  h->bucket_index_delta = bucket_index_delta;
+}
+
+
+/* Set the starting block and bucket and the probe deltas for the raw
+   hash values H according to the current number of dictionary
+   blocks. */
+
+void omflib_hash_set (struct omflib *p, const struct omfhash *h)
+{
+  p->block_index = h->block_index % p->dict_blocks;
+  p->block_index_delta = h->block_index_delta % p->dict_blocks;
   if (p->block_index_delta == 0)
     p->block_index_delta = 1;
-  p->bucket_index = bucket_index % 37;
-  p->bucket_index_delta = bucket_index_delta % 37;
+  p->bucket_index = h->bucket_index % 37;
+  p->bucket_index_delta = h->bucket_index_delta % 37;
   if (p->bucket_index_delta == 0)
     p->bucket_index_delta = 1;
 }
 
 
+void omflib_hash (struct omflib *p, const byte *name)
+{
+  struct omfhash h;
+
+  omflib_hash_raw (name, &h);
+  omflib_hash_set (p, &h);
+}
+
+
+/* Return the sum of LEN bytes at SRC, modulo 256.  The checksum byte
+   of an OMF record makes the sum of all the bytes of the record zero.
+   With SSE2, sum 16 bytes at a time with PSADBW. */
+
+byte omflib_byte_sum (const byte *src, long len)
+{
+  unsigned sum;
+#if defined (__SSE2__)
+  __m128i acc, zero;
+
+  acc = _mm_setzero_si128 ();
+  zero = _mm_setzero_si128 ();
+  while (len >= 16)
+    {
+      acc = _mm_add_epi64 (acc, _mm_sad_epu8 (_mm_loadu_si128
+                                              ((const __m128i *)src), zero));
+      src += 16; len -= 16;
+    }
+  sum = (_mm_cvtsi128_si32 (acc)
+         + _mm_cvtsi128_si32 (_mm_srli_si128 (acc, 8)));
+#else
+  sum = 0;
+  while (len >= 4)
+    {
+      sum += src[0] + src[1] + src[2] + src[3];
+      src += 4; len -= 4;
+    }
+#endif
+  while (len > 0)
+    {
+      sum += *src++;
+      --len;
+    }
+  return (byte)sum;
+}
+
+
 int omflib_module_name (char *dst, const char *src)
 {
   const char *base;
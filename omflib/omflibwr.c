@@ -14,28 +14,28 @@ int omflib_write_record (struct omflib *p, byte rec_type, word rec_len,
 {
   struct omf_rec rec;
   byte sum;
-  int i, len;
+  int len;
   char name[256];
 
   rec.rec_type = rec_type;
   rec.rec_len = (chksum ? rec_len + 1 : rec_len);
-  if (fwrite (&rec, sizeof (rec), 1, p->f) != 1
-      || fwrite (buffer, rec_len, 1, p->f) != 1)
-    return omflib_set_error (error);
+  if (omflib_write (p, &rec, sizeof (rec), error) != 0
+      || omflib_write (p, buffer, rec_len, error) != 0)
+    return -1;
   if (chksum)
     {
       sum = rec_type + (rec.rec_len & 0xff) + (rec.rec_len >> 8);
-      for (i = 0; i < rec_len; ++i)
-        sum += buffer[i];
+      sum += omflib_byte_sum (buffer, rec_len);
       sum = (byte)(256 - sum);
-      if (fputc (sum, p->f) == EOF)
-        return omflib_set_error (error);
+      if (omflib_write (p, &sum, 1, error) != 0)
+        return -1;
     }
   switch (rec_type)
     {
     case MODEND:
     case MODEND|REC32:
-      if (omflib_pad (p->f, p->page_size, FALSE, error) != 0)
+      if (omflib_pad (p, p->page_size, FALSE, error) != 0
+          || omflib_add_mod (p, p->mod_name, p->mod_page, error) != 0)
         return -1;
       if (p->state != OS_SIMPLE)
         {
@@ -88,7 +88,7 @@ int omflib_write_module (struct omflib *p, const char *name, word *pagep,
       strcpy (error, "Module name too long");
       return -1;
     }
-  long_page = ftell (p->f) / p->page_size;
+  long_page = omflib_tell (p) / p->page_size;
   if (long_page > 65535)
     {
       strcpy (error, "Library too big -- increase page size");
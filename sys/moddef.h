@@ -93,7 +93,8 @@ typedef enum
   _MDE_DOT_EXPECTED,
   _MDE_STRING_TOO_LONG,
   _MDE_INVALID_ORDINAL,
-  _MDE_INVALID_STMT
+  _MDE_INVALID_STMT,
+  _MDE_NO_MEMORY
 } _md_error;
 
 typedef union
@@ -175,10 +176,23 @@ typedef union
     } stub;                     /* STUB */
 } _md_stmt;
 
+/* An entry of an EXPORTS statement, for _md_parse_batch(). */
+
+typedef struct
+{
+  const char *entryname;
+  const char *internalname;     /* NULL if not given */
+  int ordinal;
+  int pwords;
+  unsigned flags;
+  long linenumber;
+} _md_export;
+
 
 long _md_get_linenumber (const struct _md *md);
 long _md_get_number (const struct _md *md);
 const char *_md_get_string (const struct _md *md);
+const char *_md_get_text (const struct _md *md, size_t *len);
 _md_token _md_get_token (const struct _md *md);
 
 _md_token _md_next_token (struct _md *md);
@@ -186,11 +200,20 @@ _md_token _md_next_token (struct _md *md);
 int _md_close (struct _md *md);
 struct _md *_md_open (const char *fname);
 struct _md *_md_use_file (FILE *f);
+struct _md *_md_use_buffer (const char *buf, size_t size);
+void _md_set_threads (struct _md *md, int n);
 
 int _md_parse (struct _md *md,
                int (*callback)(struct _md *md, const _md_stmt *stmt,
                                _md_token token, void *arg),
                void *arg);
+int _md_parse_batch (struct _md *md,
+                     int (*callback)(struct _md *md, const _md_stmt *stmt,
+                                     _md_token token, void *arg),
+                     int (*batch_callback)(struct _md *md,
+                                           const _md_export *exports,
+                                           int count, void *arg),
+                     void *arg);
 
 const char *_md_errmsg (_md_error code);
 
@@ -36,7 +36,29 @@ extern "C" {
 
 #endif
 
+/* Tables of a symbol index */
+
+#define OMFIDX_SYMBOLS  0
+#define OMFIDX_MODULES  1
+
 struct omflib;
+struct omfidx;
+
+/* Dictionary statistics, see omflib_dict_stats() */
+
+#define OMFLIB_FILL_BINS  8
+
+struct omflib_dict_stats
+{
+  int blocks;                   /* Number of dictionary blocks */
+  int full_blocks;              /* Blocks marked as full */
+  int symbols;                  /* Number of entries */
+  int retries;                  /* Dictionary size increments (output) */
+  long probe_sum;               /* Buckets probed to find all entries */
+  int probe_max;                /* Most buckets probed for one entry */
+  long wasted_bytes;            /* Unused bytes in all blocks */
+  int fill_hist[OMFLIB_FILL_BINS]; /* Blocks by used bytes, 64 per bin */
+};
 
 struct omflib *omflib_open (const char *fname, char *error);
 struct omflib *omflib_create (const char *fname, int page_size, char *error);
@@ -44,6 +66,8 @@ int omflib_close (struct omflib *p, char *error);
 int omflib_module_name (char *dst, const char *src);
 int omflib_find_module (struct omflib *p, const char *name, char *error);
 int omflib_mark_deleted (struct omflib *p, const char *name, char *error);
+int omflib_mark_deleted_list (struct omflib *p, const char * const *names,
+    int n, char *error);
 int omflib_pubdef_walk (struct omflib *p, word page,
     int (*walker)(const char *name, char *error), char *error);
 int omflib_extract (struct omflib *p, const char *name, char *error);
@@ -61,7 +85,25 @@ int omflib_add_pub (struct omflib *p, const char *name, word page,
     char *error);
 int omflib_header (struct omflib *p, char *error);
 int omflib_find_symbol (struct omflib *p, const char *name, char *error);
+int omflib_find_symbols (struct omflib *p, const char * const *names,
+    int n, int *pages, char *error);
 long omflib_page_pos (struct omflib *p, int page);
+int omflib_dict_retries (struct omflib *p);
+int omflib_dict_stats (struct omflib *p, struct omflib_dict_stats *st,
+    char *error);
+int omflib_alloc_count (struct omflib *p, long *bytes);
+byte omflib_byte_sum (const byte *src, long len);
+int omflib_write_index (struct omflib *p, const char *fname, char *error);
+struct omfidx *omflib_index_open (const char *fname, char *error);
+int omflib_index_close (struct omfidx *x);
+int omflib_index_check (struct omfidx *x, const char *lib_fname,
+    char *error);
+int omflib_index_search (struct omfidx *x, int table, const char *prefix,
+    int *count);
+int omflib_index_find (struct omfidx *x, int table, const char *name);
+int omflib_index_count (struct omfidx *x, int table);
+int omflib_index_entry (struct omfidx *x, int table, int n,
+    const char **name, int *page);
 
 #if defined (__cplusplus)
 }